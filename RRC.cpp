@@ -1,6 +1,9 @@
 #include "RRC.h"
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 
@@ -47,12 +50,33 @@ static Workspace::variable_t vars[] = {
   { "APD (ms)",
     "Action potential duration of cell (ms)",
     Workspace::STATE, },
+  { "Dynamic Clamp Current (nA)",
+    "Modeled current (nA) injected by dynamic clamp",
+    Workspace::STATE, },
+  { "Max dV/dt (mV/ms)",
+    "Maximum rate of depolarization of last analyzed beat (mV/ms)",
+    Workspace::STATE, },
+  { "Upstroke Velocity (mV/ms)",
+    "Mean dV/dt from 10% to 90% of amplitude of last analyzed beat (mV/ms)",
+    Workspace::STATE, },
+  { "Peak Voltage (mV)",
+    "Peak overshoot of last analyzed beat (mV)",
+    Workspace::STATE, },
+  { "Plateau Voltage (mV)",
+    "Mean voltage from 20% to 50% of APD90 of last analyzed beat (mV)",
+    Workspace::STATE, },
+  { "Triangulation (ms)",
+    "APD90 - APD30 of last analyzed beat (ms)",
+    Workspace::STATE, },
+  { "Resting Drift (mV)",
+    "Change in resting membrane voltage from previous beat (mV)",
+    Workspace::STATE, },
   // Stimulus Parameters
-  { "Stimulus Window (ms)",
-    "Window of time after stimulus that is ignored by APD calculation",
+  { "BCL (ms)",
+    "Basic cycle length (ms)",
     Workspace::PARAMETER, },
   { "Stimulus Amplitude (nA)",
-    "Amplitude of stimulation pulse (nA)",
+    "Amplitude of stimulation pulse (nA or pA/pF)",
     Workspace::PARAMETER, },
   { "Stimulus Length (ms)",
     "Duration of stimulation pulse (nA)",
@@ -65,10 +89,10 @@ static Workspace::variable_t vars[] = {
     Workspace::PARAMETER, },
   // RRC Threshold Parameters
   { "Threshold Start Amplitude (nA)",
-    "Starting amplitude for RRC threshold test (nA)",
+    "Starting amplitude for RRC threshold test (nA or pA/pF)",
     Workspace::PARAMETER, },
   { "Threshold Amplitude Increment (nA)",
-    "Increment amplitude of RRC threshold test (nA)",
+    "Increment amplitude of RRC threshold test (nA or pA/pF)",
     Workspace::PARAMETER, },
   { "Threshold Beat Number",
     "Number of beats before each RRC injection",
@@ -105,15 +129,156 @@ static Workspace::variable_t vars[] = {
   { "Minimum APD (ms)",
     "Minimum depolarization duration considered to be an action potential (ms)",
     Workspace::PARAMETER, },
+  { "Stimulus Window (ms)",
+    "Window of time after stimulus that is ignored by APD calculation",
+    Workspace::PARAMETER, },
+  // Dynamic Clamp Parameters
+  { "Dynamic Clamp Model",
+    "Modeled current injected by dynamic clamp: 0 off, 1 IKr, 2 IK1",
+    Workspace::PARAMETER, },
+  { "Dynamic Clamp Conductance (nS)",
+    "Conductance of modeled current. Negative values block the current",
+    Workspace::PARAMETER, },
+  { "Dynamic Clamp EK (mV)",
+    "Potassium reversal potential of modeled current (mV)",
+    Workspace::PARAMETER, },
+  // RRC Waveform Parameters
+  { "RRC Shape",
+    "Waveform of RRC injection: 0 square, 1 ramp, 2 exponential, 3 file",
+    Workspace::PARAMETER, },
+  { "RRC Time Constant (ms)",
+    "Decay time constant of exponential RRC injection (ms)",
+    Workspace::PARAMETER, },
+  // Restitution Parameters
+  { "Restitution Protocol",
+    "Protocol started by restitution button: 0 S1-S2, 1 dynamic",
+    Workspace::PARAMETER, },
+  { "Restitution BCL Decrement (ms)",
+    "Decrement of BCL or S1-S2 interval after each step (ms)",
+    Workspace::PARAMETER, },
+  { "Restitution Minimum BCL (ms)",
+    "Shortest BCL or S1-S2 interval of restitution protocol (ms)",
+    Workspace::PARAMETER, },
+  { "Restitution APD Tolerance (ms)",
+    "Change in APD between beats considered converged (ms)",
+    Workspace::PARAMETER, },
+  { "Restitution Converged Beats",
+    "Consecutive converged beats that end a restitution step",
+    Workspace::PARAMETER, },
+  { "Restitution Maximum Beats",
+    "Beats that end a restitution step without convergence",
+    Workspace::PARAMETER, },
+  // Watchdog Parameters
+  { "Watchdog Minimum Voltage (mV)",
+    "Lowest membrane voltage allowed during a protocol (mV)",
+    Workspace::PARAMETER, },
+  { "Watchdog Maximum Voltage (mV)",
+    "Highest membrane voltage allowed during a protocol (mV)",
+    Workspace::PARAMETER, },
+  { "Watchdog Range Time (ms)",
+    "Time voltage may stay out of range before protocol stops, 0 disables (ms)",
+    Workspace::PARAMETER, },
+  { "Watchdog Missed Beats",
+    "Consecutive beats without AP that stop protocol, 0 disables",
+    Workspace::PARAMETER, },
+  { "Watchdog Stuck Beats",
+    "Consecutive stimuli before repolarization that stop protocol, 0 disables",
+    Workspace::PARAMETER, },
+  // Latency Parameters
+  { "Latency Test Amplitude (nA)",
+    "Amplitude of test pulses measuring response latency (nA)",
+    Workspace::PARAMETER, },
+  // APD Detector Parameters
+  { "APD Peak Hold (ms)",
+    "Time peak must hold before it is taken as the AP peak (ms)",
+    Workspace::PARAMETER, },
+  { "APD Upstroke Threshold (mV)",
+    "Voltage that denotes start of action potential (mV)",
+    Workspace::PARAMETER, },
+  { "Analysis Decimation",
+    "Ticks averaged into each sample of APD detection, 1 for every tick",
+    Workspace::PARAMETER, },
+  // Capacitance Parameters
+  { "Cm Test Amplitude (nA)",
+    "Amplitude of current steps measuring membrane capacitance (nA)",
+    Workspace::PARAMETER, },
 };
 
 // Number of variables in vars
 static size_t num_vars = sizeof(vars) / sizeof(Workspace::variable_t);
 
+RRC::OverlayPlot::OverlayPlot(QWidget *parent) :
+    QWidget(parent), samplesPerBeat(0), period(1) {
+  setMinimumSize(300, 200);
+}
+
+void RRC::OverlayPlot::refresh(BeatOverlay &overlay, double period) {
+  if (!overlay.copy(beats, samples, samplesPerBeat))
+    return;
+  this->period = period;
+  update();
+}
+
+void RRC::OverlayPlot::paintEvent(QPaintEvent *) {
+  QPainter painter(this);
+  painter.setRenderHint(QPainter::Antialiasing);
+  painter.fillRect(rect(), QColor(255, 255, 255));
+  if (beats.empty())
+    return;
+
+  // Axis limits from every beat shown
+  size_t longest = 1;
+  double vMin = samples[0];
+  double vMax = samples[0];
+  for (size_t j = 0; j < beats.size(); j++) {
+    const double *v = &samples[j * samplesPerBeat];
+    for (size_t i = 0; i < beats[j].samples; i++) {
+      vMin = std::min(vMin, v[i]);
+      vMax = std::max(vMax, v[i]);
+    }
+    longest = std::max(longest, static_cast<size_t>(beats[j].samples));
+  }
+  if (vMax - vMin < 1)
+    vMax = vMin + 1;
+  double xScale = static_cast<double>(width()) / longest;
+  double yScale = (height() - 20.0) / (vMax - vMin);
+
+  // At most one point per pixel column, newest beat drawn last and thickest
+  size_t step = longest / std::max(width(), 1) + 1;
+  QPolygonF line;
+  for (size_t j = 0; j < beats.size(); j++) {
+    QColor color(160, 160, 160);
+    if (beats[j].injection == BeatRecord::SUB)
+      color = QColor(0, 0, 220);
+    else if (beats[j].injection == BeatRecord::SUPRA)
+      color = QColor(220, 0, 0);
+    else if (beats[j].injection == BeatRecord::TEST)
+      color = QColor(230, 140, 0);
+
+    const double *v = &samples[j * samplesPerBeat];
+    line.clear();
+    for (size_t i = 0; i < beats[j].samples; i += step)
+      line.append(QPointF(i * xScale, 10 + (vMax - v[i]) * yScale));
+    painter.setPen(QPen(color, j + 1 == beats.size() ? 2 : 1));
+    painter.drawPolyline(line);
+  }
+
+  // Scale and legend
+  painter.setPen(QColor(0, 0, 0));
+  painter.drawText(4, 20, QString::number(vMax, 'f', 0) + " mV");
+  painter.drawText(4, height() - 4, QString::number(vMin, 'f', 0) + " mV");
+  painter.drawText(width() - 70, height() - 4,
+                   QString::number(longest * period, 'f', 0) + " ms");
+  painter.setPen(QColor(0, 0, 220));
+  painter.drawText(width() - 70, 20, "Sub");
+  painter.setPen(QColor(220, 0, 0));
+  painter.drawText(width() - 40, 20, "Supra");
+}
+
 RRC::Module::Module() :
     QWidget(MainWindow::getInstance()->centralWidget()),RT::Thread(0),
     Workspace::Instance("Repolarization Reserve Current Module",
-                        vars, num_vars) {
+                        vars, num_vars), rest_points(256) {
 
   // Build module GUI
   setWindowTitle(QString::number(getID()) +
@@ -137,248 +302,22 @@ RRC::Module::~Module() {
 void RRC::Module::execute() {
   voltage = input(0) * 1e3 - ljp;
 
-  switch(execute_mode) {
-    case IDLE:
-      break;
-
-    case PACE: // Static pacing
-      time += period;
-      time_int += 1;
-
-      if (time_int == 0 && pace_recordData && !recording)
-        dataRecord_start();
-
-      // If time is greater than BCL, advance the beat
-      if (time_int - bcl_startTime >= bcl_int) {
-        beatNumber++;
-        bcl_startTime = time_int;
-        apd_vmRest = voltage;
-        // If AP has not ended before new stimulus, do not restart APD
-        // calculation
-        if (apd_mode != DOWN)
-          // First step is APD calculate called at each stimulus
-          calculateAPD(1);
-      }
-
-      // Stimulate cell for denoted stimulation length
-      if ((time_int - bcl_startTime) < stim_length_int) {
-        // Stimulus amplitude in nA, convert to A for amplifier
-        outputCurrent = stim_amplitude * 1e-9;
-      }
-      else
-        outputCurrent = 0;
-
-      // Set module output
-      output(0) = outputCurrent;
-
-      // Calculate APD
-      calculateAPD(2); // Second step of APD calculation
-      break;
-
-    case STIMTHRESHOLD: // Stimulus threshold search
-      time += period;
-      time_int += 1;
-
-      if (time_int == 0 && stim_recordData && !recording)
-        dataRecord_start();
-
-      // Apply stimulus for given number of ms (StimLength)
-      if (time_int - bcl_startTime < stim_length_int) {
-        stim_backToBaseline = false;
-
-        // stimulsLevel is in nA, convert to A for amplifier
-        output(0) = stim_stimulusLevel * 1e-9;
-      }
-      else {
-        output(0) = 0;
-
-        // Find peak voltage after stimulus
-        if (voltage > stim_peakVoltage)
-          stim_peakVoltage = voltage;
-
-        // If Vm is back to resting membrane potential (within 2 mV;
-        // determined when threshold detection button is first pressed)
-        // Vrest: voltage at the time threshold test starts
-        if (voltage - stim_vmRest < 2) {
-          if (!stim_backToBaseline) {
-            stim_responseDuration = time - stim_startTime;
-            stim_responseTime = time;
-            stim_backToBaseline = true;
-          }
-
-          // Calculate time length of voltage response
-          // If the response was more than 50ms long and peakVoltage is
-          // more than 10mV, consider it an action potential
-          if (stim_responseDuration > 50 && stim_peakVoltage > 10) {
-            // Set the current stimulus value as 1.25x calculated threshold
-            stim_amplitude = stim_stimulusLevel * 1.25;
-            stim_onFlag = false;
-            execute_mode = IDLE;
-
-            if (recording)
-              dataRecord_stop();
-          }
-          else { // If no action potential occurred, and Vm is back to rest
-            // If the cell has rested for  200ms since returning to baseline
-            if (time - stim_responseTime > 200) {
-              // Increase the magnitude of the stimulus and try again
-              stim_stimulusLevel += 0.1;
-
-              // Record the time of stimulus application
-              stim_startTime = time;
-              bcl_startTime = time_int;
-            }
-          }
-        }
-      }
-      break;
-
-    case RRCTHRESHOLD: // repolarization reserve current threshold search
-      time += period;
-      time_int += 1;
-
-      if (time_int == 0 && thresh_recordData && !recording)
-        dataRecord_start();
-
-      // If time is greater than BCL, advance the beat
-      if (time_int - bcl_startTime >= bcl_int) {
-        // Compare APDs between previous RRC injection to see if it passes
-        // APD cutoff, if so, end threshold test
-        if (beatNumber_int % thresh_beatNumber == 0) {
-          if (thresh_previousAPD < 0) // Less than 0 before first RRC injection
-            thresh_previousAPD = apd;
-          // If cell has not repolarized prior to stim, end search
-          else if (apd_mode == DOWN)
-            thresh_rrcThreshFound = true;
-          // Check if RRC injection APD passes cutoff based on previous APD
-          else if (apd >= thresh_previousAPD * (1 + (thresh_apdCutoff / 100.0)))
-            thresh_rrcThreshFound = true;
-          else { // Continue search, increase RRC amplitude
-            thresh_previousAPD = apd;
-            thresh_rrcAmplitude += thresh_ampIncrement;
-          }
-        }
-
-        if (thresh_rrcThreshFound) {
-          execute_mode = IDLE;
-          thresh_onFlag = false;
-          output(0) = 0;
-
-          if (recording)
-            dataRecord_stop();
-          break;
-        }
-
-        beatNumber++;
-        beatNumber_int++;
-        bcl_startTime = time_int;
-        apd_vmRest = voltage;
-
-        // If AP has not ended before new stimulus, do not restart APD
-        // calculation
-        if (apd_mode != DOWN)
-          // First step in APD calculate called at each stimulus
-          calculateAPD(1);
-
-        // Set start and end time for RRC injection
-        rrc_startTime = stim_length_int + (rrc_delay / period);
-        // If length is set to 0, RRC continues until next stimulus
-        if (rrc_length == 0)
-          rrc_endTime = bcl_int;
-        else
-          rrc_endTime = rrc_length / period; // Convert to unitless
-      }
-
-      outputCurrent = 0;
-      // Stimulate cell for denoted stimulation length
-      if ((time_int - bcl_startTime) < stim_length_int) {
-        // Stimulus amplitude in nA, convert to A for amplifier
-        outputCurrent += stim_amplitude * 1e-9;
-      }
-      // Perform RRC injection every rrc_beatNumber beats
-      if (beatNumber_int % thresh_beatNumber == 0) {
-        if ((time_int - bcl_startTime) > rrc_startTime &&
-            (time_int - bcl_startTime) < rrc_endTime)
-          outputCurrent += thresh_rrcAmplitude * 1e-9;
-      }
-      // Set module output
-      output(0) = outputCurrent;
-
-      // Calculate APD
-      calculateAPD(2); // Second step of APD calculation
-      break;
-
-    case RRCPROTOCOL: // Random repolarization reserve current injection
-      time += period;
-      time_int += 1;
-
-      if (time_int == 0 && rrcProtocol_recordData && !recording)
-        dataRecord_start();
-
-      // If time is greater than BCL, advance the beat
-      if (time_int - bcl_startTime >= bcl_int) {
-        if (beatNumber >= rrc_endBeatNumber) { // End of protocol
-          if (recording) {
-            dataRecord_stop();
-          }
-
-          rrcProtocol_onFlag = false;
-          execute_mode = IDLE;
-          output(0) = 0;
-          break;
-        }
-
-        beatNumber++;
-        beatNumber_int++;
-        bcl_startTime = time_int;
-        apd_vmRest = voltage;
-        // If AP has not ended before new stimulus, do not restart APD
-        // calculation
-        if (apd_mode != DOWN)
-          // First step is APD calculate called at each stimulus
-          calculateAPD(1);
-
-        // Used to determine whether RRC injection will be performed
-        // Random number between 1 and 100
-        rrc_random_injection = std::rand() % 100 + 1;
-        // Used to determine if injection is sub- or supra- threshold
-        rrc_random_threshold = std::rand() % 100 + 1;
-        // Set start and end time for RRC injection
-        rrc_startTime = stim_length_int + (rrc_delay / period);
-        // If length is set to 0, RRC continues until next stimulus
-        if (rrc_length == 0)
-          rrc_endTime = bcl_int;
-        else
-          rrc_endTime = rrc_length / period; // Convert to unitless
-      }
-
-      outputCurrent = 0;
-      // Stimulate cell for denoted stimulation length
-      if ((time_int - bcl_startTime) < stim_length_int) {
-        // Stimulus amplitude in nA, convert to A for amplifier
-        outputCurrent += stim_amplitude * 1e-9;
-      }
-      // Perform RRC injection every rrc_beatNumber beats and if random
-      // number is greater than rrc_chance
-      if (beatNumber_int % rrc_beatNumber == 0 &&
-          rrc_random_injection <= rrc_chance) {
-        if ((time_int - bcl_startTime) > rrc_startTime &&
-            (time_int - bcl_startTime) < rrc_endTime) {
-          if (rrc_random_threshold >= 50)
-            outputCurrent +=
-                rrc_amplitude * (1 + (rrc_thresholdWindow / 100.0)) * 1e-9;
-          else
-            outputCurrent +=
-                rrc_amplitude * (1 - (rrc_thresholdWindow / 100.0)) * 1e-9;
-        }
-      }
-      // Set module output
-      output(0) = outputCurrent;
-
-      // Calculate APD
-      calculateAPD(2); // Second step of APD calculation
-      break;
-  }
+  // Protocol of current mode
+  execute_tick(*this);
+
+  // Watchdog, output is zeroed in the tick it trips
+  if (execute_mode != IDLE && watchdog.tick(voltage, period))
+    watchdogTrip();
+
+  // Trace of tick, written to disk by trace writer thread and published to
+  // live export while a protocol runs
+  RRC::TraceRecord record = {time, voltage, output(0),
+                             static_cast<int32_t>(beatNumber) +
+                             trace_beatOffset, execute_mode};
+  if (recording && trace_sink->isOpen())
+    trace_sink->push(record);
+  if (export_memory.isOpen() && execute_mode != IDLE)
+    export_memory.pushSample(record);
 }
 
 void RRC::Module::createGUI() {
@@ -402,6 +341,10 @@ void RRC::Module::createGUI() {
   setLayout(layout);
   layout->addWidget(rrcWindow);
 
+  // Overlay plot is drawn by hand, place it below its settings
+  overlay_plot = new OverlayPlot(rrcWindow);
+  rrcUi.gridLayout_7->addWidget(overlay_plot, 1, 0, 1, 2);
+
   // Set Ui refresh rate
   QTimer *timer = new QTimer(this);
   timer->start(100); // 100ms refresh rate
@@ -412,7 +355,10 @@ void RRC::Module::createGUI() {
   rrcUi.stim_amplitude_edit->setValidator(new QDoubleValidator(this));
   rrcUi.stim_length_edit->setValidator(new QDoubleValidator(this));
   rrcUi.ljp_edit->setValidator(new QDoubleValidator(this));
-  rrcUi.cm_edit->setValidator(new QDoubleValidator(this));
+  // Cm divides pA/pF amplitudes, it must be positive
+  rrcUi.cm_edit->setValidator(new QDoubleValidator(0.001, 1e6, 3, this));
+  rrcUi.latency_amplitude_edit->setValidator(new QDoubleValidator(this));
+  rrcUi.cm_amplitude_edit->setValidator(new QDoubleValidator(this));
   // RRC threshold tab
   rrcUi.thresh_startAmplitude_edit->setValidator(new QDoubleValidator(this));
   rrcUi.thresh_ampIncrement_edit->setValidator(new QDoubleValidator(this));
@@ -426,21 +372,42 @@ void RRC::Module::createGUI() {
   rrcUi.rrc_beatNumber_edit->setValidator(new QIntValidator(this));
   rrcUi.rrc_chance_edit->setValidator(new QIntValidator(this));
   rrcUi.rrc_endBeatNumber_edit->setValidator(new QIntValidator(this));
+  // Decay time constant must be positive
+  rrcUi.rrc_tau_edit->setValidator(new QDoubleValidator(0.001, 1e6, 3, this));
   // APD tab
   rrcUi.apd_repolPercent_edit->setValidator(new QIntValidator(this));
   rrcUi.apd_min_edit->setValidator(new QIntValidator(this));
   rrcUi.apd_stimWindow_edit->setValidator(new QIntValidator(this));
+  rrcUi.apd_peakHold_edit->setValidator(new QDoubleValidator(this));
+  rrcUi.apd_upstrokeThreshold_edit->setValidator(new QDoubleValidator(this));
+  rrcUi.analysis_decimation_edit->setValidator(
+      new QIntValidator(1, 1000, this));
+  // Data tab
+  rrcUi.trace_voltageResolution_edit->
+      setValidator(new QDoubleValidator(1e-6, 1e6, 6, this));
+  rrcUi.trace_currentResolution_edit->
+      setValidator(new QDoubleValidator(1e-6, 1e6, 6, this));
+  // Dynamic clamp tab
+  rrcUi.dc_conductance_edit->setValidator(new QDoubleValidator(this));
+  rrcUi.dc_ek_edit->setValidator(new QDoubleValidator(this));
+  // Restitution tab
+  rrcUi.rest_step_edit->setValidator(new QDoubleValidator(this));
+  rrcUi.rest_minBcl_edit->setValidator(new QDoubleValidator(this));
+  rrcUi.rest_tolerance_edit->setValidator(new QDoubleValidator(this));
+  rrcUi.rest_convergedBeats_edit->setValidator(new QIntValidator(this));
+  rrcUi.rest_maxBeats_edit->setValidator(new QIntValidator(this));
+  // Overlay tab
+  rrcUi.overlay_beats_edit->setValidator(new QIntValidator(1, 100, this));
+  // Statistics tab
+  rrcUi.stats_window_edit->setValidator(new QIntValidator(2, 10000, this));
+  // Watchdog tab
+  rrcUi.watchdog_vMin_edit->setValidator(new QDoubleValidator(this));
+  rrcUi.watchdog_vMax_edit->setValidator(new QDoubleValidator(this));
+  rrcUi.watchdog_rangeTime_edit->setValidator(new QDoubleValidator(this));
+  rrcUi.watchdog_missedBeats_edit->setValidator(new QIntValidator(this));
+  rrcUi.watchdog_stuckBeats_edit->setValidator(new QIntValidator(this));
 
   // Connect rrcUi elements to slot functions
-  // Buttons box
-  QObject::connect(rrcUi.stimThreshold_button, SIGNAL(clicked()),
-                   this, SLOT(toggle_stimThreshold()));
-  QObject::connect(rrcUi.pace_button, SIGNAL(clicked()),
-                   this, SLOT(toggle_pace()));
-  QObject::connect(rrcUi.rrcThreshold_button, SIGNAL(clicked()),
-                   this, SLOT(toggle_rrcThreshold()));
-  QObject::connect(rrcUi.rrcProtocol_button, SIGNAL(clicked()),
-                   this, SLOT(toggle_rrcProtocol()));
   // RRC threshold tab
   QObject::connect(rrcUi.thresh_startAmplitude_edit, SIGNAL(returnPressed()),
                    this, SLOT(modify()));
@@ -461,6 +428,14 @@ void RRC::Module::createGUI() {
                    this, SLOT(modify()));
   QObject::connect(rrcUi.cm_edit, SIGNAL(returnPressed()),
                    this, SLOT(modify()));
+  QObject::connect(rrcUi.latency_amplitude_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.cm_amplitude_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.cm_beforePacing_check, SIGNAL(clicked()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.amplitude_density_check, SIGNAL(clicked()),
+                   this, SLOT(toggle_density()));
   // RRC protocol tab
   QObject::connect(rrcUi.rrc_amplitude_edit, SIGNAL(returnPressed()),
                    this, SLOT(modify()));
@@ -476,6 +451,12 @@ void RRC::Module::createGUI() {
                    this, SLOT(modify()));
   QObject::connect(rrcUi.rrc_endBeatNumber_edit, SIGNAL(returnPressed()),
                    this, SLOT(modify()));
+  QObject::connect(rrcUi.rrc_shape_comboBox, SIGNAL(activated(int)),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.rrc_tau_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.rrc_waveformFile_button, SIGNAL(clicked()),
+                   this, SLOT(loadRRCWaveform()));
   // APD tab
   QObject::connect(rrcUi.apd_repolPercent_edit, SIGNAL(returnPressed()),
                    this, SLOT(modify()));
@@ -483,6 +464,52 @@ void RRC::Module::createGUI() {
                    this, SLOT(modify()));
   QObject::connect(rrcUi.apd_stimWindow_edit, SIGNAL(returnPressed()),
                    this, SLOT(modify()));
+  QObject::connect(rrcUi.apd_peakHold_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.apd_upstrokeThreshold_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.analysis_decimation_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  // Dynamic clamp tab
+  QObject::connect(rrcUi.dc_model_comboBox, SIGNAL(activated(int)),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.dc_conductance_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.dc_ek_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  // Restitution tab
+  QObject::connect(rrcUi.rest_protocol_comboBox, SIGNAL(activated(int)),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.rest_step_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.rest_minBcl_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.rest_tolerance_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.rest_convergedBeats_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.rest_maxBeats_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  // Sequence tab
+  QObject::connect(rrcUi.sequence_file_button, SIGNAL(clicked()),
+                   this, SLOT(loadSequence()));
+  // Overlay tab
+  QObject::connect(rrcUi.overlay_beats_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  // Statistics tab
+  QObject::connect(rrcUi.stats_window_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  // Watchdog tab
+  QObject::connect(rrcUi.watchdog_vMin_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.watchdog_vMax_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.watchdog_rangeTime_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.watchdog_missedBeats_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.watchdog_stuckBeats_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
   // Data tab
   QObject::connect(rrcUi.stimThreshold_dataCheck, SIGNAL(clicked()),
                    this, SLOT(modify()));
@@ -492,39 +519,123 @@ void RRC::Module::createGUI() {
                    this, SLOT(modify()));
   QObject::connect(rrcUi.rrcProtocol_dataCheck, SIGNAL(clicked()),
                    this, SLOT(modify()));
+  QObject::connect(rrcUi.restitution_dataCheck, SIGNAL(clicked()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.trace_format_comboBox, SIGNAL(activated(int)),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.trace_file_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.trace_voltageResolution_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.trace_currentResolution_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.beatLog_dataCheck, SIGNAL(clicked()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.control_path_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.export_name_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.checkpoint_file_edit, SIGNAL(returnPressed()),
+                   this, SLOT(modify()));
+  QObject::connect(rrcUi.resume_button, SIGNAL(clicked()),
+                   this, SLOT(resumeProtocol()));
   // Timer
   QObject::connect(timer, SIGNAL(timeout()),
                    this, SLOT(refreshDisplay()));
 
-  // Connections to allow only one button being toggled at a time
-  // Stim threshold button
-  QObject::connect(rrcUi.stimThreshold_button, SIGNAL(toggled(bool)),
-                   rrcUi.pace_button, SLOT(setDisabled(bool)));
-  QObject::connect(rrcUi.stimThreshold_button, SIGNAL(toggled(bool)),
-                   rrcUi.rrcProtocol_button, SLOT(setDisabled(bool)));
-  QObject::connect(rrcUi.stimThreshold_button, SIGNAL(toggled(bool)),
-                   rrcUi.rrcThreshold_button, SLOT(setDisabled(bool)));
-  // Pace button
-  QObject::connect(rrcUi.pace_button, SIGNAL(toggled(bool)),
-                   rrcUi.stimThreshold_button, SLOT(setDisabled(bool)));
-  QObject::connect(rrcUi.pace_button, SIGNAL(toggled(bool)),
-                   rrcUi.rrcThreshold_button, SLOT(setDisabled(bool)));
-  QObject::connect(rrcUi.pace_button, SIGNAL(toggled(bool)),
-                   rrcUi.rrcProtocol_button, SLOT(setDisabled(bool)));
-  // RRC threshold button
-  QObject::connect(rrcUi.rrcThreshold_button, SIGNAL(toggled(bool)),
-                   rrcUi.stimThreshold_button, SLOT(setDisabled(bool)));
-  QObject::connect(rrcUi.rrcThreshold_button, SIGNAL(toggled(bool)),
-                   rrcUi.pace_button, SLOT(setDisabled(bool)));
-  QObject::connect(rrcUi.rrcThreshold_button, SIGNAL(toggled(bool)),
-                   rrcUi.rrcProtocol_button, SLOT(setDisabled(bool)));
-  // RRC protocol button
-  QObject::connect(rrcUi.rrcProtocol_button, SIGNAL(toggled(bool)),
-                   rrcUi.stimThreshold_button, SLOT(setDisabled(bool)));
-  QObject::connect(rrcUi.rrcProtocol_button, SIGNAL(toggled(bool)),
-                   rrcUi.pace_button, SLOT(setDisabled(bool)));
-  QObject::connect(rrcUi.rrcProtocol_button, SIGNAL(toggled(bool)),
-                   rrcUi.rrcThreshold_button, SLOT(setDisabled(bool)));
+  // Widgets reached by the control socket, named as in saved settings
+  control_params["bcl"] = rrcUi.bcl_edit;
+  control_params["stim_amplitude"] = rrcUi.stim_amplitude_edit;
+  control_params["stim_length"] = rrcUi.stim_length_edit;
+  control_params["ljp"] = rrcUi.ljp_edit;
+  control_params["cm"] = rrcUi.cm_edit;
+  control_params["latency_amplitude"] = rrcUi.latency_amplitude_edit;
+  control_params["cm_amplitude"] = rrcUi.cm_amplitude_edit;
+  control_params["cm_beforePacing"] = rrcUi.cm_beforePacing_check;
+  control_params["amplitude_density"] = rrcUi.amplitude_density_check;
+  control_params["thresh_startAmplitude"] = rrcUi.thresh_startAmplitude_edit;
+  control_params["thresh_ampIncrement"] = rrcUi.thresh_ampIncrement_edit;
+  control_params["thresh_beatNumber"] = rrcUi.thresh_beatNumber_edit;
+  control_params["thresh_apdCutoff"] = rrcUi.thresh_apdCutoff_edit;
+  control_params["rrc_amplitude"] = rrcUi.rrc_amplitude_edit;
+  control_params["rrc_delay"] = rrcUi.rrc_delay_edit;
+  control_params["rrc_length"] = rrcUi.rrc_length_edit;
+  control_params["rrc_thresholdWindow"] = rrcUi.rrc_thresholdWindow_edit;
+  control_params["rrc_beatNumber"] = rrcUi.rrc_beatNumber_edit;
+  control_params["rrc_chance"] = rrcUi.rrc_chance_edit;
+  control_params["rrc_endBeatNumber"] = rrcUi.rrc_endBeatNumber_edit;
+  control_params["rrc_shape"] = rrcUi.rrc_shape_comboBox;
+  control_params["rrc_tau"] = rrcUi.rrc_tau_edit;
+  control_params["apd_repolPercent"] = rrcUi.apd_repolPercent_edit;
+  control_params["apd_min"] = rrcUi.apd_min_edit;
+  control_params["apd_stimWindow"] = rrcUi.apd_stimWindow_edit;
+  control_params["apd_peakHold"] = rrcUi.apd_peakHold_edit;
+  control_params["apd_upstrokeThreshold"] = rrcUi.apd_upstrokeThreshold_edit;
+  control_params["analysis_decimation"] = rrcUi.analysis_decimation_edit;
+  control_params["dc_model"] = rrcUi.dc_model_comboBox;
+  control_params["dc_conductance"] = rrcUi.dc_conductance_edit;
+  control_params["dc_ek"] = rrcUi.dc_ek_edit;
+  control_params["rest_protocol"] = rrcUi.rest_protocol_comboBox;
+  control_params["rest_step"] = rrcUi.rest_step_edit;
+  control_params["rest_minBcl"] = rrcUi.rest_minBcl_edit;
+  control_params["rest_tolerance"] = rrcUi.rest_tolerance_edit;
+  control_params["rest_convergedBeats"] = rrcUi.rest_convergedBeats_edit;
+  control_params["rest_maxBeats"] = rrcUi.rest_maxBeats_edit;
+  control_params["overlay_beats"] = rrcUi.overlay_beats_edit;
+  control_params["stats_window"] = rrcUi.stats_window_edit;
+  control_params["watchdog_vMin"] = rrcUi.watchdog_vMin_edit;
+  control_params["watchdog_vMax"] = rrcUi.watchdog_vMax_edit;
+  control_params["watchdog_rangeTime"] = rrcUi.watchdog_rangeTime_edit;
+  control_params["watchdog_missedBeats"] = rrcUi.watchdog_missedBeats_edit;
+  control_params["watchdog_stuckBeats"] = rrcUi.watchdog_stuckBeats_edit;
+  control_params["stim_recordData"] = rrcUi.stimThreshold_dataCheck;
+  control_params["pace_recordData"] = rrcUi.pace_dataCheck;
+  control_params["thresh_recordData"] = rrcUi.rrcThreshold_dataCheck;
+  control_params["rrcProtocol_recordData"] = rrcUi.rrcProtocol_dataCheck;
+  control_params["rest_recordData"] = rrcUi.restitution_dataCheck;
+  control_params["trace_format"] = rrcUi.trace_format_comboBox;
+  control_params["trace_file"] = rrcUi.trace_file_edit;
+  control_params["trace_voltageResolution"] =
+      rrcUi.trace_voltageResolution_edit;
+  control_params["trace_currentResolution"] =
+      rrcUi.trace_currentResolution_edit;
+  control_params["beatLog_enabled"] = rrcUi.beatLog_dataCheck;
+  control_params["checkpoint_file"] = rrcUi.checkpoint_file_edit;
+
+  // Protocol buttons, only one of them can be checked at a time. Modes
+  // without a toggle of their own are started by toggleMode()
+  const ModeButton modes[] = {
+    {"stim_threshold", rrcUi.stimThreshold_button, &stim_onFlag,
+     STIMTHRESHOLD, &stim_recordData, 0},
+    {"pace", rrcUi.pace_button, &pace_onFlag, PACE, &pace_recordData, 0},
+    {"rrc_threshold", rrcUi.rrcThreshold_button, &thresh_onFlag,
+     RRCTHRESHOLD, &thresh_recordData, 0},
+    {"rrc_protocol", rrcUi.rrcProtocol_button, &rrcProtocol_onFlag,
+     RRCPROTOCOL, &rrcProtocol_recordData, 0},
+    {"restitution", rrcUi.restitution_button, &rest_onFlag, IDLE,
+     &rest_recordData, &Module::toggle_restitution},
+    {"sequence", rrcUi.sequence_button, &sequence_onFlag, IDLE, 0,
+     &Module::toggle_sequence},
+    {"latency", rrcUi.latency_button, &latency_onFlag, LATENCYTEST, 0,
+     &Module::toggle_latency},
+    {"capacitance", rrcUi.cm_button, &cm_onFlag, CAPACITANCE, 0,
+     &Module::toggle_capacitance}};
+  mode_buttons.assign(modes, modes + sizeof(modes) / sizeof(modes[0]));
+  for (size_t i = 0; i < mode_buttons.size(); i++) {
+    QObject::connect(mode_buttons[i].button, SIGNAL(clicked()),
+                     this, SLOT(toggle_mode()));
+    for (size_t j = 0; j < mode_buttons.size(); j++)
+      if (j != i)
+        QObject::connect(mode_buttons[i].button, SIGNAL(toggled(bool)),
+                         mode_buttons[j].button, SLOT(setDisabled(bool)));
+  }
+  // Amplitudes are results passed on by the steps of a running sequence
+  QObject::connect(rrcUi.sequence_button, SIGNAL(toggled(bool)),
+                   rrcUi.stim_amplitude_edit, SLOT(setDisabled(bool)));
+  QObject::connect(rrcUi.sequence_button, SIGNAL(toggled(bool)),
+                   rrcUi.rrc_amplitude_edit, SLOT(setDisabled(bool)));
+  QObject::connect(rrcUi.sequence_button, SIGNAL(toggled(bool)),
+                   rrcUi.amplitude_density_check, SLOT(setDisabled(bool)));
 
   subWindow->show();
   subWindow->adjustSize();
@@ -536,11 +647,25 @@ void RRC::Module::initialize() {
   voltage = 0;
   beatNumber = 0;
   apd = 0;
+  dc_current = 0;
+  feature_maxDvdt = 0;
+  feature_upstrokeVelocity = 0;
+  feature_peakVoltage = 0;
+  feature_plateauVoltage = 0;
+  feature_triangulation = 0;
+  feature_restingDrift = 0;
   // Connect states to workspace
   Workspace::Instance::setData(Workspace::STATE, 0, &time);
   Workspace::Instance::setData(Workspace::STATE, 1, &voltage);
   Workspace::Instance::setData(Workspace::STATE, 2, &beatNumber);
   Workspace::Instance::setData(Workspace::STATE, 3, &apd);
+  Workspace::Instance::setData(Workspace::STATE, 4, &dc_current);
+  Workspace::Instance::setData(Workspace::STATE, 5, &feature_maxDvdt);
+  Workspace::Instance::setData(Workspace::STATE, 6, &feature_upstrokeVelocity);
+  Workspace::Instance::setData(Workspace::STATE, 7, &feature_peakVoltage);
+  Workspace::Instance::setData(Workspace::STATE, 8, &feature_plateauVoltage);
+  Workspace::Instance::setData(Workspace::STATE, 9, &feature_triangulation);
+  Workspace::Instance::setData(Workspace::STATE, 10, &feature_restingDrift);
 
   // Workspace parameters
   //// Stimulus tab
@@ -549,6 +674,11 @@ void RRC::Module::initialize() {
   stim_length = 1;
   ljp = 0;
   cm = 100;
+  latency_amplitude = -0.5;
+  latency_ticks = 0;
+  cm_amplitude = -0.05;
+  cm_beforePacing = false;
+  amplitude_density = false;
   //// RRC threshold tab
   thresh_startAmplitude = 0;
   thresh_ampIncrement = 0.01;
@@ -562,15 +692,52 @@ void RRC::Module::initialize() {
   rrc_beatNumber = 3;
   rrc_chance = 50;
   rrc_endBeatNumber = 100;
+  rrc_shape = RRC_SQUARE;
+  rrc_tau = 50;
   //// APD tab
   apd_repolPercent = 90;
   apd_min = 50;
   apd_stimWindow = 4;
+  apd_peakHold = 5;
+  apd_upstrokeThreshold = -40;
+  analysis_decimation = 1;
+  //// Dynamic clamp tab
+  dc_model = DC_OFF;
+  dc_conductance = 0;
+  dc_ek = -85;
+  //// Restitution tab
+  rest_protocol = REST_S1S2;
+  rest_step = 50;
+  rest_minBcl = 200;
+  rest_tolerance = 2;
+  rest_convergedBeats = 5;
+  rest_maxBeats = 50;
+  //// Overlay tab
+  overlay_beats = 10;
+  //// Statistics tab
+  stats_window = 30;
+  //// Watchdog tab
+  watchdog_vMin = -150;
+  watchdog_vMax = 100;
+  watchdog_rangeTime = 1000;
+  watchdog_missedBeats = 10;
+  watchdog_stuckBeats = 5;
   //// Data tab
   pace_recordData = false;
   stim_recordData = false;
   thresh_recordData = false;
   rrcProtocol_recordData = false;
+  rest_recordData = false;
+  trace_format = TRACE_OFF;
+  trace_file = QDir::homePath() + "/rrc_trace";
+  trace_voltageResolution = 0.01;
+  trace_currentResolution = 1;
+  trace_sink = &trace_writer;
+  trace_beatOffset = 0;
+  beatLog_enabled = false;
+  control_path = "";
+  export_name = "";
+  checkpoint_file = "";
 
   // Set user interface values
   //// Stimulus tab
@@ -579,6 +746,12 @@ void RRC::Module::initialize() {
   rrcUi.stim_length_edit->setText(QString::number(stim_length));
   rrcUi.ljp_edit->setText(QString::number(ljp));
   rrcUi.cm_edit->setText(QString::number(cm));
+  rrcUi.latency_amplitude_edit->setText(QString::number(latency_amplitude));
+  updateLatencyDisplay();
+  rrcUi.cm_amplitude_edit->setText(QString::number(cm_amplitude));
+  rrcUi.cm_beforePacing_check->setChecked(cm_beforePacing);
+  rrcUi.amplitude_density_check->setChecked(amplitude_density);
+  updateAmplitudeUnits();
   //// RRC threshold tab
   rrcUi.thresh_startAmplitude_edit->
       setText(QString::number(thresh_startAmplitude));
@@ -593,15 +766,73 @@ void RRC::Module::initialize() {
   rrcUi.rrc_beatNumber_edit->setText(QString::number(rrc_beatNumber));
   rrcUi.rrc_chance_edit->setText(QString::number(rrc_chance));
   rrcUi.rrc_endBeatNumber_edit->setText(QString::number(rrc_endBeatNumber));
+  rrcUi.rrc_shape_comboBox->setCurrentIndex(rrc_shape);
+  rrcUi.rrc_tau_edit->setText(QString::number(rrc_tau));
+  rrcUi.rrc_waveformFile_display->setText(rrc_waveformFile);
   //// APD tab
   rrcUi.apd_repolPercent_edit->setText(QString::number(apd_repolPercent));
   rrcUi.apd_min_edit->setText(QString::number(apd_min));
   rrcUi.apd_stimWindow_edit->setText(QString::number(apd_stimWindow));
+  rrcUi.apd_peakHold_edit->setText(QString::number(apd_peakHold));
+  rrcUi.apd_upstrokeThreshold_edit->setText(
+      QString::number(apd_upstrokeThreshold));
+  rrcUi.analysis_decimation_edit->setText(
+      QString::number(analysis_decimation));
+  //// Dynamic clamp tab
+  rrcUi.dc_model_comboBox->setCurrentIndex(dc_model);
+  rrcUi.dc_conductance_edit->setText(QString::number(dc_conductance));
+  rrcUi.dc_ek_edit->setText(QString::number(dc_ek));
+  //// Restitution tab
+  rrcUi.rest_protocol_comboBox->setCurrentIndex(rest_protocol);
+  rrcUi.rest_step_edit->setText(QString::number(rest_step));
+  rrcUi.rest_minBcl_edit->setText(QString::number(rest_minBcl));
+  rrcUi.rest_tolerance_edit->setText(QString::number(rest_tolerance));
+  rrcUi.rest_convergedBeats_edit->setText(QString::number(rest_convergedBeats));
+  rrcUi.rest_maxBeats_edit->setText(QString::number(rest_maxBeats));
+  //// Overlay tab
+  rrcUi.overlay_beats_edit->setText(QString::number(overlay_beats));
+  //// Statistics tab
+  rrcUi.stats_window_edit->setText(QString::number(stats_window));
+  //// Watchdog tab
+  rrcUi.watchdog_vMin_edit->setText(QString::number(watchdog_vMin));
+  rrcUi.watchdog_vMax_edit->setText(QString::number(watchdog_vMax));
+  rrcUi.watchdog_rangeTime_edit->setText(QString::number(watchdog_rangeTime));
+  rrcUi.watchdog_missedBeats_edit->
+      setText(QString::number(watchdog_missedBeats));
+  rrcUi.watchdog_stuckBeats_edit->setText(QString::number(watchdog_stuckBeats));
   //// Data tab
   rrcUi.stimThreshold_dataCheck->setChecked(stim_recordData);
   rrcUi.pace_dataCheck->setChecked(pace_recordData);
   rrcUi.rrcThreshold_dataCheck->setChecked(thresh_recordData);
   rrcUi.rrcProtocol_dataCheck->setChecked(rrcProtocol_recordData);
+  rrcUi.restitution_dataCheck->setChecked(rest_recordData);
+  rrcUi.trace_format_comboBox->setCurrentIndex(trace_format);
+  rrcUi.trace_file_edit->setText(trace_file);
+  rrcUi.trace_voltageResolution_edit->
+      setText(QString::number(trace_voltageResolution));
+  rrcUi.trace_currentResolution_edit->
+      setText(QString::number(trace_currentResolution));
+  rrcUi.beatLog_dataCheck->setChecked(beatLog_enabled);
+  rrcUi.control_path_edit->setText(control_path);
+  rrcUi.export_name_edit->setText(export_name);
+  rrcUi.checkpoint_file_edit->setText(checkpoint_file);
+
+  rrcUi.sequence_file_display->setText(sequence_file);
+
+  // Execute variables
+  setMode(IDLE);
+  recording = false;
+  watchdog_tripped = false;
+  latency_onFlag = false;
+  cm_onFlag = false;
+  cm_nextMode = IDLE;
+  cm_nextRecordData = false;
+  sequence_onFlag = false;
+  sequence_step = 0;
+  sequence_transitions = 0;
+  sequence_lastSuccess = true;
+  sequence_id = 0;
+  reset();
 }
 
 // Slot Functions
@@ -610,8 +841,64 @@ void RRC::Module::refreshDisplay() {
   rrcUi.voltage_display->display(voltage);
   rrcUi.beatNumber_display->display(beatNumber);
   rrcUi.apd_display->display(apd);
+  updateBeatFeatures();
+  updateRestitution();
+  updateControl();
 
   if (execute_mode == IDLE) {
+    // Protocol ended in real-time thread, finish trace and beat log files
+    if (trace_sink->isOpen() || beatLog_file.is_open() || rest_file.is_open())
+      fileRecord_stop();
+
+    // A protocol that ended or was stopped is not resumed
+    if (checkpoint_writer.isOpen()) {
+      if (checkpoint_writer.error())
+        QMessageBox::warning(this, "Checkpoint",
+                             "Error while writing checkpoint file");
+      checkpoint_writer.stop(true);
+    }
+
+    // Protocol stopped by watchdog, its partial results are not used
+    if (watchdog_tripped) {
+      static const char *reasons[] = {"", "Voltage out of range",
+                                      "Missing action potentials",
+                                      "Stimuli before repolarization"};
+      watchdog_tripped = false;
+      for (size_t i = 0; i < mode_buttons.size(); i++)
+        mode_buttons[i].button->setChecked(false);
+      QString message = QString(reasons[watchdog.reason]) + " at " +
+          QString::number(time) + " ms, beat " + QString::number(beatNumber);
+      rrcUi.watchdog_status_display->setText(message);
+      QMessageBox::warning(this, "Watchdog", "Protocol stopped: " + message);
+    }
+
+    // Capacitance test ended, alone or before the protocol in cm_nextMode
+    if (rrcUi.cm_button->isChecked() && !cm_onFlag) {
+      rrcUi.cm_button->setChecked(false);
+      if (updateCapacitance())
+        modify();
+      else
+        QMessageBox::warning(this, "Capacitance",
+                             "Response to test steps is not an RC charging "
+                             "curve, check amplitude");
+    }
+    else if (cm_nextMode != IDLE && !cm_onFlag) {
+      if (updateCapacitance()) {
+        modify();
+        toggleMode(cm_nextMode, true, cm_nextRecordData);
+      }
+      else { // Protocol is not started with an unknown Cm
+        cm_nextMode = IDLE;
+        for (size_t i = 0; i < mode_buttons.size(); i++) {
+          *mode_buttons[i].onFlag = false;
+          mode_buttons[i].button->setChecked(false);
+        }
+        QMessageBox::warning(this, "Capacitance",
+                             "Protocol not started, response to test steps "
+                             "is not an RC charging curve");
+      }
+    }
+
     if (rrcUi.stimThreshold_button->isChecked() && !stim_onFlag) {
       rrcUi.stimThreshold_button->setChecked(false);
       rrcUi.stim_amplitude_edit->setText(QString::number(stim_amplitude));
@@ -626,8 +913,40 @@ void RRC::Module::refreshDisplay() {
     else if (rrcUi.rrcProtocol_button->isChecked() && !rrcProtocol_onFlag) {
       rrcUi.rrcProtocol_button->setChecked(false);
     }
+    else if (rrcUi.restitution_button->isChecked() && !rest_onFlag) {
+      rrcUi.restitution_button->setChecked(false);
+    }
+    else if (rrcUi.latency_button->isChecked() && !latency_onFlag) {
+      rrcUi.latency_button->setChecked(false);
+      if (latency_probe.valid()) {
+        latency_ticks = latency_probe.ticks();
+        updateLatencyDisplay();
+      }
+      else
+        QMessageBox::warning(this, "Latency",
+                             "No response to test pulses, check amplitude");
+    }
+    else if (rrcUi.sequence_button->isChecked() && !sequence_onFlag) {
+      rrcUi.sequence_button->setChecked(false);
+      rrcUi.sequence_status_display->setText(
+          "Finished, " +
+          QString::fromStdString(sequence_steps[sequence_step].label) +
+          (sequence_lastSuccess ? " succeeded" : " failed"));
+      // Results passed forward by the sequence
+      rrcUi.stim_amplitude_edit->setText(QString::number(stim_amplitude));
+      rrcUi.rrc_amplitude_edit->setText(QString::number(rrc_amplitude));
+      rrcUi.rrc_thresholdTest_display->display(rrc_amplitude);
+      modify();
+    }
+  }
+  else if (sequence_onFlag) {
+    rrcUi.sequence_status_display->setText(
+        "Step " + QString::number(sequence_step + 1) + " of " +
+        QString::number(sequence_steps.size()) + ", " +
+        QString::fromStdString(sequence_steps[sequence_step].label));
   }
-  else if (execute_mode == RRCPROTOCOL) {
+
+  if (execute_mode == RRCPROTOCOL) {
     if (beatNumber_int % rrc_beatNumber == 0 &&
         rrc_random_injection <= rrc_chance) {
       if (rrc_random_threshold >= 50)
@@ -650,39 +969,113 @@ void RRC::Module::modify() {
   // Get user interface values
   //// Stimulus tab
   bcl = rrcUi.bcl_edit->text().toDouble();
-  stim_amplitude = rrcUi.stim_amplitude_edit->text().toDouble();
+  // A running sequence owns the amplitudes, its steps pass them on in the
+  // real-time thread. Its results are written to the edits when it ends
+  if (!sequence_onFlag)
+    stim_amplitude = rrcUi.stim_amplitude_edit->text().toDouble();
   stim_length = rrcUi.stim_length_edit->text().toDouble();
   ljp = rrcUi.ljp_edit->text().toDouble();
-  cm = rrcUi.cm_edit->text().toDouble();
+  // An unfinished Cm edit keeps the last Cm, so amplitude scale stays valid
+  if (rrcUi.cm_edit->text().toDouble() > 0)
+    cm = rrcUi.cm_edit->text().toDouble();
+  else
+    rrcUi.cm_edit->setText(QString::number(cm));
+  latency_amplitude = rrcUi.latency_amplitude_edit->text().toDouble();
+  cm_amplitude = rrcUi.cm_amplitude_edit->text().toDouble();
+  cm_beforePacing = rrcUi.cm_beforePacing_check->isChecked();
+  amplitude_density = rrcUi.amplitude_density_check->isChecked();
+  // Units are folded into the currents used by the real-time thread
+  amplitude_scale = amplitude_density ? cm * 1e-12 : 1e-9;
+  stim_current = stim_amplitude * amplitude_scale;
+  updateAmplitudeUnits();
   //// RRC threshold tab
   thresh_startAmplitude = rrcUi.thresh_startAmplitude_edit->text().toDouble();
   thresh_ampIncrement = rrcUi.thresh_ampIncrement_edit->text().toDouble();
   thresh_beatNumber = rrcUi.thresh_beatNumber_edit->text().toInt();
   thresh_apdCutoff = rrcUi.thresh_apdCutoff_edit->text().toInt();
   //// RRC protocol tab
-  rrc_amplitude = rrcUi.rrc_amplitude_edit->text().toDouble();
+  if (!sequence_onFlag)
+    rrc_amplitude = rrcUi.rrc_amplitude_edit->text().toDouble();
   rrc_delay = rrcUi.rrc_delay_edit->text().toDouble();
   rrc_length = rrcUi.rrc_length_edit->text().toInt();
   rrc_thresholdWindow = rrcUi.rrc_thresholdWindow_edit->text().toInt();
   rrc_beatNumber = rrcUi.rrc_beatNumber_edit->text().toInt();
   rrc_chance = rrcUi.rrc_chance_edit->text().toInt();
   rrc_endBeatNumber = rrcUi.rrc_endBeatNumber_edit->text().toInt();
+  rrc_shape = static_cast<rrc_shape_t>(rrcUi.rrc_shape_comboBox->currentIndex());
+  rrc_tau = std::max(0.001, rrcUi.rrc_tau_edit->text().toDouble());
   //// APD tab
   apd_repolPercent = rrcUi.apd_repolPercent_edit->text().toInt();
   apd_min = rrcUi.apd_min_edit->text().toInt();
   apd_stimWindow = rrcUi.apd_stimWindow_edit->text().toInt();
+  apd_peakHold = rrcUi.apd_peakHold_edit->text().toDouble();
+  apd_upstrokeThreshold = rrcUi.apd_upstrokeThreshold_edit->text().toDouble();
+  analysis_decimation =
+      std::max(1, rrcUi.analysis_decimation_edit->text().toInt());
+  apd_detector.repolPercent = apd_repolPercent;
+  apd_detector.stimWindow = apd_stimWindow;
+  apd_detector.minApd = apd_min;
+  apd_detector.peakHold = apd_peakHold;
+  apd_detector.upstrokeThreshold = apd_upstrokeThreshold;
+  analysis_decimator.factor = analysis_decimation;
+  //// Dynamic clamp tab
+  dc_model = static_cast<dc_model_t>(rrcUi.dc_model_comboBox->currentIndex());
+  dc_conductance = rrcUi.dc_conductance_edit->text().toDouble();
+  dc_ek = rrcUi.dc_ek_edit->text().toDouble();
+  //// Restitution tab
+  rest_protocol =
+      static_cast<rest_protocol_t>(rrcUi.rest_protocol_comboBox->currentIndex());
+  rest_step = rrcUi.rest_step_edit->text().toDouble();
+  rest_minBcl = rrcUi.rest_minBcl_edit->text().toDouble();
+  rest_tolerance = rrcUi.rest_tolerance_edit->text().toDouble();
+  rest_convergedBeats = rrcUi.rest_convergedBeats_edit->text().toInt();
+  rest_maxBeats = rrcUi.rest_maxBeats_edit->text().toInt();
+  //// Overlay tab, takes effect when next protocol starts
+  overlay_beats = rrcUi.overlay_beats_edit->text().toInt();
+  //// Statistics tab, takes effect when next protocol starts
+  stats_window = rrcUi.stats_window_edit->text().toInt();
+  //// Watchdog tab
+  watchdog_vMin = rrcUi.watchdog_vMin_edit->text().toDouble();
+  watchdog_vMax = rrcUi.watchdog_vMax_edit->text().toDouble();
+  watchdog_rangeTime = rrcUi.watchdog_rangeTime_edit->text().toDouble();
+  watchdog_missedBeats = rrcUi.watchdog_missedBeats_edit->text().toInt();
+  watchdog_stuckBeats = rrcUi.watchdog_stuckBeats_edit->text().toInt();
+  watchdog.vMin = watchdog_vMin;
+  watchdog.vMax = watchdog_vMax;
+  watchdog.rangeTime = watchdog_rangeTime;
+  watchdog.missedBeats = watchdog_missedBeats;
+  watchdog.stuckBeats = watchdog_stuckBeats;
   //// Data tab
   stim_recordData = rrcUi.stimThreshold_dataCheck->isChecked();
   pace_recordData = rrcUi.pace_dataCheck->isChecked();
   thresh_recordData = rrcUi.rrcThreshold_dataCheck->isChecked();
   rrcProtocol_recordData = rrcUi.rrcProtocol_dataCheck->isChecked();
+  rest_recordData = rrcUi.restitution_dataCheck->isChecked();
+  trace_format =
+      static_cast<trace_format_t>(rrcUi.trace_format_comboBox->currentIndex());
+  trace_file = rrcUi.trace_file_edit->text();
+  trace_voltageResolution = std::max(
+      1e-6, rrcUi.trace_voltageResolution_edit->text().toDouble());
+  trace_currentResolution = std::max(
+      1e-6, rrcUi.trace_currentResolution_edit->text().toDouble());
+  beatLog_enabled = rrcUi.beatLog_dataCheck->isChecked();
+  if (rrcUi.control_path_edit->text() != control_path) {
+    control_path = rrcUi.control_path_edit->text();
+    openControl();
+  }
+  if (rrcUi.export_name_edit->text() != export_name) {
+    export_name = rrcUi.export_name_edit->text();
+    openExport();
+  }
+  // Takes effect when next protocol starts
+  checkpoint_file = rrcUi.checkpoint_file_edit->text();
 
   // Set parameters to workspace
   setValue(0, bcl);
   setValue(1, stim_amplitude);
   setValue(2, stim_length);
-  setValue(3, ljp);
-  setValue(4, cm);
+  setValue(3, cm);
+  setValue(4, ljp);
   setValue(5, thresh_startAmplitude);
   setValue(6, thresh_ampIncrement);
   setValue(7, thresh_beatNumber);
@@ -697,6 +1090,30 @@ void RRC::Module::modify() {
   setValue(16, apd_repolPercent);
   setValue(17, apd_min);
   setValue(18, apd_stimWindow);
+  setValue(19, dc_model);
+  setValue(20, dc_conductance);
+  setValue(21, dc_ek);
+  setValue(22, rrc_shape);
+  setValue(23, rrc_tau);
+  setValue(24, rest_protocol);
+  setValue(25, rest_step);
+  setValue(26, rest_minBcl);
+  setValue(27, rest_tolerance);
+  setValue(28, rest_convergedBeats);
+  setValue(29, rest_maxBeats);
+  setValue(30, watchdog_vMin);
+  setValue(31, watchdog_vMax);
+  setValue(32, watchdog_rangeTime);
+  setValue(33, watchdog_missedBeats);
+  setValue(34, watchdog_stuckBeats);
+  setValue(35, latency_amplitude);
+  setValue(36, apd_peakHold);
+  setValue(37, apd_upstrokeThreshold);
+  setValue(38, analysis_decimation);
+  setValue(39, cm_amplitude);
+
+  // Injection window and waveform depend on the parameters above
+  compileRRCWaveform();
 
   setActive(active);
 }
@@ -714,205 +1131,1298 @@ void RRC::Module::dataRecord_stop() {
   recording = false;
 }
 
+// Trace and beat log recording functions, called outside of real-time thread
+void RRC::Module::fileRecord_start() {
+  QString fileName = trace_file +
+      QDateTime::currentDateTime().toString("_yyyyMMdd_hhmmss");
+
+  if (beatLog_enabled) {
+    beatLog_file.open((fileName + ".beats.csv").toLocal8Bit().constData());
+    if (beatLog_file.is_open())
+      beatLog_file << "beat,injection,stimulus_time_ms,apd_ms,rest_mv,"
+          "rest_drift_mv,max_dvdt_mv_per_ms,upstroke_velocity_mv_per_ms,"
+          "peak_mv,plateau_mv,apd30_ms,apd90_ms,triangulation_ms\n";
+    else
+      QMessageBox::warning(this, "Beat Log",
+                           "Unable to create beat log " + fileName);
+  }
+
+  if (execute_mode == S1S2RESTITUTION || execute_mode == DYNAMICRESTITUTION) {
+    rest_file.open((fileName + ".restitution.csv").toLocal8Bit().constData());
+    if (rest_file.is_open())
+      rest_file << "cycle_length_ms,di_ms,apd_ms,beats,converged\n";
+    else
+      QMessageBox::warning(this, "Restitution",
+                           "Unable to create restitution file " + fileName);
+  }
+
+  openTrace(fileName);
+}
+
+// Opens trace file of selected format at the current period
+void RRC::Module::openTrace(const QString &fileName) {
+  bool opened;
+
+  switch (trace_format) {
+    case TRACE_RAW:
+      trace_sink = &trace_writer;
+      opened = trace_writer.open((fileName + ".rrct").toStdString(), period);
+      break;
+
+    case TRACE_COMPRESSED:
+      // Current resolution in pA, convert to A
+      trace_sink = &trace_compressedWriter;
+      opened = trace_compressedWriter.open((fileName + ".rrcz").toStdString(),
+                                           period, trace_voltageResolution,
+                                           trace_currentResolution * 1e-12);
+      break;
+
+    default: // TRACE_OFF
+      return;
+  }
+
+  if (!opened)
+    QMessageBox::warning(this, "Trace File",
+                         "Unable to create trace file " + fileName);
+}
+
+void RRC::Module::fileRecord_stop() {
+  if (beatLog_file.is_open()) {
+    // Log beats still being analyzed
+    beat_analyzer.wait();
+    updateBeatFeatures();
+    beatLog_file.close();
+  }
+
+  if (rest_file.is_open()) {
+    updateRestitution();
+    double apdMax, amplitude, tau;
+    if (rest_fit.fit(apdMax, amplitude, tau))
+      rest_file << "# APD = " << apdMax << " - " << amplitude <<
+          " * exp(-DI / " << tau << "), maximum slope " <<
+          rest_fit.maxSlope() << '\n';
+    rest_file.close();
+  }
+
+  if (!trace_sink->isOpen())
+    return;
+
+  trace_sink->close();
+
+  if (trace_sink->error())
+    QMessageBox::warning(this, "Trace File",
+                         "Error while writing trace file");
+  else if (trace_sink->dropped() > 0)
+    QMessageBox::warning(this, "Trace File",
+                         QString::number(trace_sink->dropped()) +
+                         " ticks were dropped from trace file");
+}
+
 void RRC::Module::reset() {
   // Grabs RTXI thread period and converts to ms (from ns)
   period = RT::System::getInstance()->getPeriod() * 1e-6;
+  export_memory.setPeriod(period);
 
   bcl_int = bcl / period;
   stim_length_int = stim_length / period;
+  amplitude_scale = amplitude_density ? cm * 1e-12 : 1e-9;
+  stim_current = stim_amplitude * amplitude_scale;
+
+  apd_detector.repolPercent = apd_repolPercent;
+  apd_detector.stimWindow = apd_stimWindow;
+  apd_detector.minApd = apd_min;
+  apd_detector.peakHold = apd_peakHold;
+  apd_detector.upstrokeThreshold = apd_upstrokeThreshold;
+  analysis_decimator.factor = analysis_decimation;
+
+  watchdog.vMin = watchdog_vMin;
+  watchdog.vMax = watchdog_vMax;
+  watchdog.rangeTime = watchdog_rangeTime;
+  watchdog.missedBeats = watchdog_missedBeats;
+  watchdog.stuckBeats = watchdog_stuckBeats;
+
+  // Beat slots hold one cycle length of samples, worker restarts empty
+  beat_analyzer.allocate(bcl_int + 1, period, overlay_beats);
+  stats_all.resize(stats_window);
+  stats_control.resize(stats_window);
+  stats_injected.resize(stats_window);
+  checkpoint_history.clear();
+  updateStatisticsDisplay();
+  trace_beatOffset = 0;
+
+  compileRRCWaveform();
+  restart();
+}
 
-  time = -period;
-  time_int = -1;
-  bcl_startTime = 0;
-  beatNumber = 1;
-  beatNumber_int = 1;
+// Restarts protocol time, beats and APD detection as RRC::Protocol, and the
+// module's beat capture and watchdog
+void RRC::Module::restart() {
+  Protocol::restart(*this);
+  beat_open = false;
+  beat_injection = BeatRecord::NONE;
+  watchdog.start();
+}
 
-  calculateAPD(1);
+// Switches the tick run by execute(). The tick of each mode is specialized
+// at compile time, so a tick only costs a call through execute_tick
+void RRC::Module::setMode(execute_mode_t mode) {
+  static void (*const ticks[])(Module &) = {
+    &IdleMode::tick<Module>,
+    &StimThresholdMode::tick<Module>,
+    &PaceMode::tick<Module>,
+    &RRCThresholdMode::tick<Module>,
+    &RRCProtocolMode::tick<Module>,
+    &RestitutionMode::tick<Module>, // S1S2RESTITUTION
+    &RestitutionMode::tick<Module>, // DYNAMICRESTITUTION
+    &LatencyMode::tick<Module>,
+    &CapacitanceMode::tick<Module>,
+  };
+  execute_tick = ticks[mode];
+  execute_mode = mode;
 }
 
-// APD calculation function
-void RRC::Module::calculateAPD(int step) {
-  switch (step) {
-    case 1:
-      apd_mode = START;
+// Sets up a protocol after restart(), from its button or a sequence step.
+// Limits of sequence steps are off unless set afterwards
+void RRC::Module::startMode(execute_mode_t mode) {
+  setMode(mode);
+  stim_maxLevel = 0;
+  thresh_maxAmplitude = 0;
+  pace_endBeat = 0;
+
+  switch (mode) {
+    case STIMTHRESHOLD:
+      stim_onFlag = true;
+      stim_vmRest = input(0) * 1e3 - ljp;
+      stim_peakVoltage = stim_vmRest;
+      stim_stimulusLevel = 2.0;
+      stim_responseDuration = 0;
+      stim_responseTime = 0;
+      stim_startTime = 0;
+      break;
+
+    case PACE:
+      pace_onFlag = true;
+      break;
+
+    case RRCTHRESHOLD:
+      thresh_onFlag = true;
+      thresh_previousAPD = -1;
+      thresh_rrcThreshFound = false;
+      thresh_rrcAmplitude = thresh_startAmplitude;
+      rrc_injectionAmplitude = thresh_rrcAmplitude * amplitude_scale;
+      break;
+
+    case RRCPROTOCOL:
+      rrcProtocol_onFlag = true;
+      rrc_random.seed(std::rand());
+      break;
+
+    case LATENCYTEST:
+      latency_onFlag = true;
+      latency_probe.start(period);
+      break;
+
+    case CAPACITANCE: // Steps were sized by cm_probe.allocate()
+      cm_onFlag = true;
+      cm_probe.start();
+      break;
+
+    case S1S2RESTITUTION: // First S1-S2 interval is one decrement below BCL
+      rest_onFlag = true;
+      rest_s1APD = -1;
+      startRestitutionStep(bcl - rest_step);
+      break;
+
+    case DYNAMICRESTITUTION: // First step is the pacing BCL
+      rest_onFlag = true;
+      rest_s1APD = -1;
+      startRestitutionStep(bcl);
+      break;
+
+    default: // IDLE
+      break;
+  }
+}
+
+// Called from the real-time thread when a protocol ends. During a sequence
+// the next step starts on the following tick, otherwise the module idles
+void RRC::Module::protocolDone(bool success) {
+  if (sequence_onFlag) {
+    const SequenceStep &step = sequence_steps[sequence_step];
+    int next = success ? step.next : step.failure;
+    sequence_lastSuccess = success;
+
+    if (next >= 0 && ++sequence_transitions < sequenceMaxTransitions) {
+      startSequenceStep(next);
+      return;
+    }
+    sequence_onFlag = false;
+  }
+  setMode(IDLE);
+}
+
+// Starts a step of the sequence, results of earlier steps are already in
+// stim_amplitude and rrc_amplitude
+void RRC::Module::startSequenceStep(int i) {
+  const SequenceStep &step = sequence_steps[i];
+  sequence_step = i;
+  // Trace of a sequence is one file, its beats continue after the last step
+  trace_beatOffset += static_cast<int>(beatNumber);
+  restart();
+
+  switch (step.mode) {
+    case SequenceStep::STIMTHRESHOLD:
+      startMode(STIMTHRESHOLD);
+      // Limit is in amplitude units, search steps in nA
+      stim_maxLevel = step.limit * amplitude_scale * 1e9;
       break;
 
-    case 2:
-      switch(apd_mode) {
-        // Find time membrane voltage passes upstroke threshold, start of AP
-        case START:
-          if (voltage >= apd_upstrokeThreshold) {
-            apd_startTime = time;
-            apd_peakVoltage = apd_vmRest;
-            apd_mode = PEAK;
-          }
-          // If stimulus fails to produce an AP, set APD to 0
-          else if ((time_int - time_int) > 2 * apd_stimWindow / period) {
-            apd_mode = DONE;
-            apd = 0;
-          }
-          break;
-
-          // Find peak of AP, points within "window" are ignored to eliminate
-          // effect of stimulus artifact
-        case PEAK:
-          // If we are outside the chosen time window after the AP
-          if ((time - apd_startTime) > apd_stimWindow) {
-            if (apd_peakVoltage < voltage) { // Find peak voltage
-              apd_peakVoltage = voltage;
-              apd_peakTime = time;
-            }
-            // Keep looking for the peak for 5ms to account for noise
-            else if ((time - apd_peakTime) > 5) {
-              double apd_amplitude;
-
-              // Amplitude of action potential based on resting membrane
-              // and peak voltage
-              apd_amplitude = apd_peakVoltage - apd_vmRest ;
-
-              // Calculate downstroke threshold based on AP amplitude and
-              // desired AP repolarization %
-              apd_downstrokeThreshold =
-                  apd_peakVoltage -
-                  (apd_amplitude * (apd_repolPercent / 100.0));
-              apd_mode = DOWN;
-            }
-          }
-          break;
-
-        case DOWN: // Find downstroke threshold and calculate APD
-          if (voltage <= apd_downstrokeThreshold) {
-            apd_endTime = time;
-            apd = time - apd_startTime;
-            apd_mode = DONE;
-          }
-          break;
-
-        default: // DONE: APD has been found, do nothing
-          break;
+    case SequenceStep::PACE:
+      startMode(PACE);
+      pace_endBeat = step.beats;
+      break;
+
+    case SequenceStep::RRCTHRESHOLD:
+      startMode(RRCTHRESHOLD);
+      // Limit and search are both in amplitude units
+      thresh_maxAmplitude = step.limit;
+      break;
+
+    case SequenceStep::RRCPROTOCOL:
+      startMode(RRCPROTOCOL);
+      break;
+  }
+}
+
+// Sets the RRC injection window and resamples its waveform to the RTXI period
+// so that each tick of injection is a single table lookup
+void RRC::Module::compileRRCWaveform() {
+  // Set start and end time for RRC injection
+  rrc_startTime = stim_length_int + (rrc_delay / period);
+  // If length is set to 0, RRC continues until next stimulus
+  if (rrc_length == 0)
+    rrc_endTime = bcl_int;
+  else
+    rrc_endTime = rrc_length / period; // Convert to unitless
+
+  // Injection occurs strictly between start and end time
+  int samples = rrc_endTime - rrc_startTime - 1;
+  if (samples < 0)
+    samples = 0;
+  rrc_waveform.assign(samples, 0);
+
+  size_t j = 0; // Interpolation index of waveform file
+  for (int i = 0; i < samples; i++) {
+    double t = i * period; // Time since start of injection (ms)
+
+    switch (rrc_shape) {
+      case RRC_RAMP: // Linear rise to full amplitude at end of injection
+        rrc_waveform[i] = (i + 1.0) / samples;
+        break;
+
+      case RRC_EXPONENTIAL: // Full amplitude decaying with rrc_tau
+        rrc_waveform[i] = std::exp(-t / rrc_tau);
+        break;
+
+      case RRC_FILE: // Linear interpolation of loaded waveform, 0 outside it
+        while (j + 1 < rrc_fileTime.size() && rrc_fileTime[j + 1] <= t)
+          j++;
+        if (j + 1 < rrc_fileTime.size() && t >= rrc_fileTime[j])
+          rrc_waveform[i] = rrc_fileValue[j] +
+              (rrc_fileValue[j + 1] - rrc_fileValue[j]) *
+              (t - rrc_fileTime[j]) / (rrc_fileTime[j + 1] - rrc_fileTime[j]);
+        break;
+
+      default: // RRC_SQUARE
+        rrc_waveform[i] = 1;
+        break;
+    }
+  }
+}
+
+// Reads a waveform file of two columns, time (ms) and relative amplitude.
+// Lines starting with # are ignored. Returns false if file is not usable.
+bool RRC::Module::readRRCWaveformFile(const QString &fileName) {
+  std::ifstream file(fileName.toLocal8Bit().constData());
+  if (!file.is_open())
+    return false;
+
+  std::vector<double> fileTime;
+  std::vector<double> fileValue;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    std::istringstream row(line);
+    double t, value;
+    if (!(row >> t >> value))
+      return false;
+    // Time must be strictly increasing for interpolation
+    if (!fileTime.empty() && t <= fileTime.back())
+      return false;
+
+    fileTime.push_back(t);
+    fileValue.push_back(value);
+  }
+  if (fileTime.size() < 2)
+    return false;
+
+  rrc_fileTime.swap(fileTime);
+  rrc_fileValue.swap(fileValue);
+  return true;
+}
+
+// APD calculation function, shared with rrc_scenarios through RRC::Protocol
+void RRC::Module::calculateAPD(int step) {
+  Protocol::calculateAPD(*this, step);
+}
+
+// Beat capture, called every tick after stimulus and APD handling. Samples
+// are stored in a slot of the beat analyzer and analyzed by its worker thread
+void RRC::Module::captureBeat() {
+  // Stimulus of a new beat hands the previous beat to the worker
+  if (time_int == bcl_startTime) {
+    // First stimulus of a protocol, step or resume ends no beat
+    if (beat_open) {
+      if (watchdog.beat(beat_apd > 0,
+                        apd_detector.mode == APDDetector::DOWN))
+        watchdogTrip();
+      // Beats counted by statistics, kept to rebuild them on resume
+      if (beat_apd > 0)
+        checkpoint_history.add(beat_apd, beat_injection);
+      beat_analyzer.endBeat(beat_apd);
+    }
+    beat_open = true;
+    beat_injection = beatInjection();
+    beat_analyzer.beginBeat(beatNumber, time, beat_injection);
+    beat_apd = -1;
+    if (execute_mode != IDLE && checkpoint_writer.isOpen())
+      checkpointBeat();
+  }
+  beat_analyzer.sample(voltage);
+}
+
+// RRC injection performed during the current beat
+int RRC::Module::beatInjection() {
+  switch (execute_mode) {
+    case RRCTHRESHOLD:
+      if (beatNumber_int % thresh_beatNumber == 0)
+        return BeatRecord::TEST;
+      return BeatRecord::NONE;
+
+    case RRCPROTOCOL:
+      if (beatNumber_int % rrc_beatNumber == 0 &&
+          rrc_random_injection <= rrc_chance) {
+        if (rrc_random_threshold >= 50)
+          return BeatRecord::SUPRA;
+        return BeatRecord::SUB;
       }
+      return BeatRecord::NONE;
+
+    default:
+      return BeatRecord::NONE;
   }
 }
 
-// Toggle funcitons
-void RRC::Module::toggle_stimThreshold() {
-  stim_onFlag = rrcUi.stimThreshold_button->isChecked();
+// Publishes beats analyzed by worker thread as workspace states and writes
+// them to the beat log, called outside of real-time thread
+void RRC::Module::updateBeatFeatures() {
+  static const char *injectionNames[] = {"none", "sub", "supra", "test"};
+  BeatRecord beat;
+  bool analyzed = false;
+
+  while (beat_analyzer.result(beat)) {
+    analyzed = true;
+
+    // Beats without an AP or that did not repolarize are left out
+    if (beat.apd > 0) {
+      stats_all.add(beat.apd);
+      if (beat.injection == BeatRecord::NONE)
+        stats_control.add(beat.apd);
+      else
+        stats_injected.add(beat.apd);
+    }
+
+    feature_maxDvdt = beat.features.maxDvdt;
+    feature_upstrokeVelocity = beat.features.upstrokeVelocity;
+    feature_peakVoltage = beat.features.peakVoltage;
+    feature_plateauVoltage = beat.features.plateauVoltage;
+    feature_triangulation = beat.features.triangulation;
+    feature_restingDrift = beat.features.restingDrift;
+
+    if (beatLog_file.is_open())
+      beatLog_file << beat.beatNumber << ','
+                   << injectionNames[beat.injection] << ','
+                   << beat.startTime << ',' << beat.apd << ','
+                   << beat.features.restingVoltage << ','
+                   << beat.features.restingDrift << ','
+                   << beat.features.maxDvdt << ','
+                   << beat.features.upstrokeVelocity << ','
+                   << beat.features.peakVoltage << ','
+                   << beat.features.plateauVoltage << ','
+                   << beat.features.apd30 << ','
+                   << beat.features.apd90 << ','
+                   << beat.features.triangulation << '\n';
+
+    if (export_memory.isOpen())
+      export_memory.pushBeat(beat);
+
+    if (control_server.hasSubscribers()) {
+      std::ostringstream line;
+      line << "beat number=" << beat.beatNumber
+           << " injection=" << injectionNames[beat.injection]
+           << " time=" << beat.startTime << " apd=" << beat.apd
+           << " rest=" << beat.features.restingVoltage
+           << " rest_drift=" << beat.features.restingDrift
+           << " max_dvdt=" << beat.features.maxDvdt
+           << " upstroke_velocity=" << beat.features.upstrokeVelocity
+           << " peak=" << beat.features.peakVoltage
+           << " plateau=" << beat.features.plateauVoltage
+           << " apd30=" << beat.features.apd30
+           << " apd90=" << beat.features.apd90
+           << " triangulation=" << beat.features.triangulation;
+      control_server.broadcast(line.str());
+    }
+  }
+
+  if (analyzed) {
+    overlay_plot->refresh(beat_analyzer.overlay(), period);
+    updateStatisticsDisplay();
+  }
+}
+
+void RRC::Module::updateStatisticsDisplay() {
+  const BeatStatistics *stats[] = {&stats_all, &stats_control,
+                                   &stats_injected};
+  QLabel *count[] = {rrcUi.stats_all_count_display,
+                     rrcUi.stats_control_count_display,
+                     rrcUi.stats_injected_count_display};
+  QLabel *mean[] = {rrcUi.stats_all_mean_display,
+                    rrcUi.stats_control_mean_display,
+                    rrcUi.stats_injected_mean_display};
+  QLabel *sd[] = {rrcUi.stats_all_sd_display,
+                  rrcUi.stats_control_sd_display,
+                  rrcUi.stats_injected_sd_display};
+  QLabel *stv[] = {rrcUi.stats_all_stv_display,
+                   rrcUi.stats_control_stv_display,
+                   rrcUi.stats_injected_stv_display};
+  QLabel *alternans[] = {rrcUi.stats_all_alternans_display,
+                         rrcUi.stats_control_alternans_display,
+                         rrcUi.stats_injected_alternans_display};
+
+  for (int i = 0; i < 3; i++) {
+    count[i]->setText(QString::number(stats[i]->count()));
+    mean[i]->setText(QString::number(stats[i]->mean(), 'f', 1));
+    sd[i]->setText(QString::number(stats[i]->sd(), 'f', 2));
+    stv[i]->setText(QString::number(stats[i]->stv(), 'f', 2));
+    alternans[i]->setText(QString::number(stats[i]->alternans(), 'f', 2));
+  }
+}
+
+// Restitution step, called at each stimulus of restitution protocols with
+// beat_apd of the beat that ended. Returns false when protocol is done
+bool RRC::Module::restitutionBeat() {
+  return Protocol::restitutionBeat(*this);
+}
+
+// Starts pacing for the next cycle length of restitution protocols
+void RRC::Module::startRestitutionStep(double cycle) {
+  Protocol::startRestitutionStep(*this, cycle);
+}
+
+// Real-time side of restitution curve, points are fitted by the GUI
+void RRC::Module::addRestitutionPoint(double di, double apd) {
+  RestitutionPoint point = {rest_cycle, di, apd, rest_stepBeats,
+                            rest_stableBeats >= rest_convergedBeats};
+  rest_points.push(point);
+}
+
+// Adds points from real-time thread to the fit and restitution file, called
+// outside of real-time thread
+void RRC::Module::updateRestitution() {
+  RestitutionPoint point;
+  bool added = false;
+
+  while (rest_points.pop(point)) {
+    added = true;
+    rest_fit.add(point.di, point.apd);
+    if (rest_file.is_open())
+      rest_file << point.cycleLength << ',' << point.di << ',' << point.apd <<
+          ',' << point.beats << ',' << point.converged << '\n';
+  }
+
+  if (execute_mode == S1S2RESTITUTION || execute_mode == DYNAMICRESTITUTION)
+    rrcUi.rest_cycle_display->setText(QString::number(rest_cycle));
+  if (!added)
+    return;
+
+  double apdMax, amplitude, tau;
+  rrcUi.rest_points_display->setText(QString::number(rest_fit.size()));
+  if (rest_fit.fit(apdMax, amplitude, tau)) {
+    rrcUi.rest_apdMax_display->setText(QString::number(apdMax, 'f', 1));
+    rrcUi.rest_amplitude_display->setText(QString::number(amplitude, 'f', 1));
+    rrcUi.rest_tau_display->setText(QString::number(tau, 'f', 1));
+    rrcUi.rest_slope_display->
+        setText(QString::number(rest_fit.maxSlope(), 'f', 2));
+  }
+}
 
+// Dynamic clamp calculation function, returns current to inject (nA)
+double RRC::Module::calculateDynamicClamp() {
+  return Protocol::calculateDynamicClamp(*this);
+}
+
+// Control socket functions, called from the GUI thread
+void RRC::Module::openControl() {
+  control_server.close();
+  if (control_path.isEmpty())
+    return;
+
+  std::string error;
+  if (!control_server.listen(control_path.toLocal8Bit().constData(), error))
+    QMessageBox::warning(this, "Control Socket", control_path + ": " +
+                         QString::fromStdString(error));
+}
+
+void RRC::Module::updateLatencyDisplay() {
+  if (latency_ticks > 0)
+    rrcUi.latency_display->setText(
+        QString::number(latency_ticks) + " ticks, " +
+        QString::number(latency_ticks * period) + " ms");
+  else
+    rrcUi.latency_display->setText("Not measured");
+}
+
+// Takes Cm from a finished capacitance test. Returns false if the test
+// failed, Cm is then unchanged
+bool RRC::Module::updateCapacitance() {
+  double cmFit, rm, tau;
+  if (!cm_probe.fit(cm_amplitude, cmFit, rm, tau)) {
+    rrcUi.cm_display->setText("Failed");
+    return false;
+  }
+
+  cm = cmFit;
+  rrcUi.cm_edit->setText(QString::number(cm, 'f', 1));
+  rrcUi.cm_display->setText(QString::number(cm, 'f', 1) + " pF, " +
+                            QString::number(rm, 'f', 0) + " MOhm, tau " +
+                            QString::number(tau, 'f', 2) + " ms");
+  return true;
+}
+
+// Labels of amplitudes show the units chosen
+void RRC::Module::updateAmplitudeUnits() {
+  QString units = amplitude_density ? "pA/pF" : "nA";
+  rrcUi.stim_amplitude_label->setText("Amplitude (" + units + "):");
+  rrcUi.thresh_startAmplitude_label->setText(
+      "Start Amplitude (" + units + "):");
+  rrcUi.thresh_ampIncrement_label->setText(
+      "Amplitude Increment (" + units + "):");
+  rrcUi.rrc_thresholdTest_display_label->setText(
+      "Threshold Test Value (" + units + "):");
+  rrcUi.rrc_amplitude_label->setText("Amplitude (" + units + "):");
+}
+
+// Called from the real-time thread. Output is zeroed in the current tick and
+// the GUI reports the reason on its next refresh
+void RRC::Module::watchdogTrip() {
+  output(0) = 0;
+  outputCurrent = 0;
+  if (recording)
+    dataRecord_stop();
+
+  for (size_t i = 0; i < mode_buttons.size(); i++)
+    *mode_buttons[i].onFlag = false;
+  cm_nextMode = IDLE;
+  watchdog_tripped = true;
+  setMode(IDLE);
+}
+
+// Keeps the last minute of samples and 4096 beats, called while the real-time
+// thread is paused
+void RRC::Module::openExport() {
+  export_memory.close();
+  if (export_name.isEmpty())
+    return;
+
+  if (!export_memory.open(export_name.toLocal8Bit().constData(),
+                          60000 / period, 4096, period))
+    QMessageBox::warning(this, "Live Export",
+                         "Unable to create shared memory " + export_name);
+}
+
+// Starts checkpoints of the protocol being started, called while the
+// real-time thread is paused
+void RRC::Module::openCheckpoint() {
+  checkpoint_writer.stop(true);
+  if (!checkpoint_file.isEmpty())
+    checkpoint_writer.start(checkpoint_file.toLocal8Bit().constData());
+}
+
+// RT. Called at the stimulus of each beat, after the mode has set up the
+// beat, so a resumed protocol runs the beat again from the same state
+void RRC::Module::checkpointBeat() {
+  ProtocolState state;
+  state.mode = execute_mode;
+  state.beatNumber = beatNumber_int;
+  state.time = time;
+  state.cycle = bcl_int * period;
+  state.stimAmplitude = stim_amplitude;
+  state.rrcAmplitude = rrc_amplitude;
+  state.rrcInjectionAmplitude = rrc_injectionAmplitude;
+  state.threshAmplitude = thresh_rrcAmplitude;
+  state.threshPreviousApd = thresh_previousAPD;
+  state.threshMaxAmplitude = thresh_maxAmplitude;
+  state.random = rrc_random.state();
+  state.randomInjection = rrc_random_injection;
+  state.randomThreshold = rrc_random_threshold;
+  state.paceEndBeat = pace_endBeat;
+  state.sequenceStep = sequence_onFlag ? sequence_step : -1;
+  state.sequenceTransitions = sequence_transitions;
+  state.sequenceId = sequence_onFlag ? sequence_id : 0;
+  state.sequenceMode = sequence_onFlag ?
+      sequence_steps[sequence_step].mode : -1;
+  state.history = checkpoint_history;
+  checkpoint_writer.push(state);
+}
+
+// Runs commands received since the last refresh
+void RRC::Module::updateControl() {
+  control_server.poll();
+
+  int client;
+  std::string line;
+  while (control_server.nextCommand(client, line))
+    control_server.reply(client, controlCommand(client, line));
+}
+
+// Commands are documented in README.md. Every reply is a single line that
+// starts with ok or error
+std::string RRC::Module::controlCommand(int client, const std::string &line) {
+  static const char *modeNames[] = {"idle", "stim_threshold", "pace",
+                                    "rrc_threshold", "rrc_protocol",
+                                    "s1s2_restitution", "dynamic_restitution",
+                                    "latency", "capacitance"};
+  std::istringstream words(line);
+  std::string command;
+  words >> command;
+
+  if (command == "get") {
+    std::string name;
+    std::string value;
+    if (!(words >> name)) {
+      std::string all = "ok";
+      const char *states[] = {"time", "voltage", "beat", "apd"};
+      for (int i = 0; i < 4; i++)
+        all += std::string(" ") + states[i] + "=" + controlGet(states[i]);
+      for (std::map<std::string, QWidget *>::const_iterator i =
+               control_params.begin(); i != control_params.end(); ++i)
+        all += " " + i->first + "=" + controlGet(i->first);
+      return all;
+    }
+    value = controlGet(name);
+    if (value.empty())
+      return "error unknown name " + name;
+    return "ok " + value;
+  }
+  else if (command == "set") {
+    return controlSet(words);
+  }
+  else if (command == "start") {
+    std::string mode;
+    words >> mode;
+    const ModeButton *entry = modeButton(mode);
+    if (!entry)
+      return "error unknown mode " + mode;
+    if (execute_mode != IDLE || sequence_onFlag)
+      return "error protocol running";
+    QPushButton *button = entry->button;
+    button->click(); // Same path as the GUI, toggle unchecks on failure
+    return button->isChecked() ? "ok" : "error " + mode + " did not start";
+  }
+  else if (command == "stop") {
+    for (size_t i = 0; i < mode_buttons.size(); i++)
+      if (mode_buttons[i].button->isChecked())
+        mode_buttons[i].button->click();
+    return "ok";
+  }
+  else if (command == "status") {
+    std::ostringstream status;
+    status << "ok mode=" << modeNames[execute_mode]
+           << " sequence=" << sequence_onFlag << " beat=" << beatNumber
+           << " time=" << time << " apd=" << apd
+           << " recording=" << recording
+           << " watchdog=" << watchdog.reason
+           << " latency_ticks=" << latency_ticks
+           << " dropped=" << beat_analyzer.dropped();
+    return status.str();
+  }
+  else if (command == "subscribe" || command == "unsubscribe") {
+    control_server.subscribe(client, command == "subscribe");
+    return "ok";
+  }
+  return "error unknown command " + command;
+}
+
+// Returns value of state or parameter, empty if name is unknown
+std::string RRC::Module::controlGet(const std::string &name) const {
+  std::ostringstream value;
+  if (name == "time")
+    value << time;
+  else if (name == "voltage")
+    value << voltage;
+  else if (name == "beat")
+    value << beatNumber;
+  else if (name == "apd")
+    value << apd;
+  else {
+    std::map<std::string, QWidget *>::const_iterator i =
+        control_params.find(name);
+    if (i == control_params.end())
+      return "";
+    if (QLineEdit *edit = qobject_cast<QLineEdit *>(i->second))
+      return edit->text().toStdString();
+    if (QComboBox *box = qobject_cast<QComboBox *>(i->second))
+      value << box->currentIndex();
+    else if (QCheckBox *check = qobject_cast<QCheckBox *>(i->second))
+      value << check->isChecked();
+  }
+  return value.str();
+}
+
+// Applies name=value pairs with a single modify(), so the real-time thread
+// is paused once for the whole set. Nothing is changed if any pair is
+// invalid
+std::string RRC::Module::controlSet(std::istream &words) {
+  std::vector<std::pair<QWidget *, QString> > values;
+  int density = -1; // amplitude_density to set, -1 if not set
+  std::string pair;
+  while (words >> pair) {
+    size_t equals = pair.find('=');
+    std::string name = pair.substr(0, equals);
+    std::map<std::string, QWidget *>::const_iterator i =
+        control_params.find(name);
+    if (equals == std::string::npos || i == control_params.end())
+      return "error unknown name " + name;
+    if (sequence_onFlag &&
+        (name == "stim_amplitude" || name == "rrc_amplitude" ||
+         name == "amplitude_density"))
+      return "error " + name + " is set by the running sequence";
+    QString value = QString::fromStdString(pair.substr(equals + 1));
+
+    // Check against the widget's own validator or range
+    bool valid = true;
+    int index = value.toInt(&valid);
+    if (QLineEdit *edit = qobject_cast<QLineEdit *>(i->second)) {
+      int position = 0;
+      valid = !edit->validator() ||
+          edit->validator()->validate(value, position) ==
+          QValidator::Acceptable;
+    }
+    else if (QComboBox *box = qobject_cast<QComboBox *>(i->second))
+      valid = valid && index >= 0 && index < box->count();
+    else
+      valid = valid && (index == 0 || index == 1);
+    if (!valid)
+      return "error invalid value " + pair;
+    // Units are changed by converting the amplitudes, as their checkbox does
+    if (name == "amplitude_density")
+      density = index;
+    else
+      values.push_back(std::make_pair(i->second, value));
+  }
+  if (values.empty() && density < 0)
+    return "error set needs name=value";
+
+  // Amplitudes set along with new units are taken in the new units
+  if (density >= 0 && density != rrcUi.amplitude_density_check->isChecked()) {
+    if (cm <= 0)
+      return "error cm must be set for pA/pF";
+    rrcUi.amplitude_density_check->setChecked(density);
+    convertAmplitudes(density);
+  }
+
+  for (size_t i = 0; i < values.size(); i++) {
+    if (QLineEdit *edit = qobject_cast<QLineEdit *>(values[i].first))
+      edit->setText(values[i].second);
+    else if (QComboBox *box = qobject_cast<QComboBox *>(values[i].first))
+      box->setCurrentIndex(values[i].second.toInt());
+    else if (QCheckBox *check = qobject_cast<QCheckBox *>(values[i].first))
+      check->setChecked(values[i].second.toInt());
+  }
+  modify();
+  return "ok";
+}
+
+// Toggle funcitons
+// Starts or stops a protocol from its button. With Measure Cm Before
+// Pacing, the capacitance test runs first and refreshDisplay() calls this
+// again with the protocol in cm_nextMode once Cm is known
+void RRC::Module::toggleMode(execute_mode_t mode, bool on, bool recordData) {
   // Make sure real-time thread is not in the middle of execution
   setActive(false);
   RRC_SyncEvent event;
   RT::System::getInstance()->postEvent(&event);
 
-  // Stimulus threshold
-  if (stim_onFlag) {
-    execute_mode = STIMTHRESHOLD;
+  // Start protocol, reinitialize parameters to start values
+  if (on && cm_beforePacing && cm_nextMode != mode) {
+    reset();
+    cm_nextMode = mode;
+    cm_nextRecordData = recordData;
+    cm_probe.allocate(period);
+    startMode(CAPACITANCE);
+    setActive(true);
+  }
+  else if (on) {
+    cm_nextMode = IDLE;
     reset();
-    stim_vmRest = input(0) * 1e3 - ljp;
-    stim_peakVoltage = stim_vmRest;
-    stim_stimulusLevel = 2.0;
-    stim_responseDuration = 0;
-    stim_responseTime = 0;
+    startMode(mode);
+    if (recordData)
+      fileRecord_start();
+    // Stimulus threshold search is short and not resumed. Restitution is not
+    // resumed either, a checkpoint does not hold the points of its curve
+    if (mode != STIMTHRESHOLD && mode != S1S2RESTITUTION &&
+        mode != DYNAMICRESTITUTION)
+      openCheckpoint();
     setActive(true);
   }
-  else { // If in middle of protocol
+  else { // Called in the middle of protocol
     if (recording) {
       ::Event::Object event(::Event::STOP_RECORDING_EVENT);
       ::Event::Manager::getInstance()->postEventRT(&event);
       recording = false;
     }
-
-    execute_mode = IDLE;
+    cm_onFlag = false;
+    cm_nextMode = IDLE;
+    setMode(IDLE);
     setActive(false);
+    fileRecord_stop();
   }
 }
 
-void RRC::Module::toggle_pace() {
-  pace_onFlag = rrcUi.pace_button->isChecked();
+// Starts or stops the protocol of the pressed button, see mode_buttons
+void RRC::Module::toggle_mode() {
+  for (size_t i = 0; i < mode_buttons.size(); i++) {
+    const ModeButton &entry = mode_buttons[i];
+    if (entry.button != sender())
+      continue;
+    if (entry.toggle) {
+      (this->*entry.toggle)();
+    }
+    else {
+      *entry.onFlag = entry.button->isChecked();
+      toggleMode(entry.mode, *entry.onFlag, *entry.recordData);
+    }
+    return;
+  }
+}
 
+// Entry of mode_buttons with the control API name, 0 if there is none
+const RRC::Module::ModeButton *
+RRC::Module::modeButton(const std::string &name) const {
+  for (size_t i = 0; i < mode_buttons.size(); i++)
+    if (name == mode_buttons[i].name)
+      return &mode_buttons[i];
+  return 0;
+}
+
+void RRC::Module::toggle_restitution() {
+  rest_onFlag = rrcUi.restitution_button->isChecked();
+
+  // Points of the previous curve are dropped before the protocol starts
+  if (rest_onFlag) {
+    rest_points.clear();
+    rest_fit.clear();
+  }
+  toggleMode(rest_protocol == REST_DYNAMIC ? DYNAMICRESTITUTION :
+             S1S2RESTITUTION, rest_onFlag, rest_recordData);
+}
+
+void RRC::Module::toggle_sequence() {
   // Make sure real-time thread is not in the middle of execution
   setActive(false);
   RRC_SyncEvent event;
   RT::System::getInstance()->postEvent(&event);
 
-  // Start protocol, reinitialize parameters to start values
-  if (pace_onFlag) {
+  // Start sequence at first step, results are passed on inside the
+  // real-time thread until the last step ends
+  if (rrcUi.sequence_button->isChecked()) {
+    if (sequence_steps.empty()) {
+      QMessageBox::warning(this, "Sequence", "No sequence file loaded");
+      rrcUi.sequence_button->setChecked(false);
+      return;
+    }
+
     reset();
-    execute_mode = PACE;
+    sequence_onFlag = true;
+    sequence_transitions = 0;
+    startSequenceStep(0);
+    if (stim_recordData || pace_recordData || thresh_recordData ||
+        rrcProtocol_recordData)
+      fileRecord_start();
+    openCheckpoint();
     setActive(true);
   }
-  else { // Called in the middle of protocol
+  else { // Called when in the middle of sequence
     if (recording) {
       ::Event::Object event(::Event::STOP_RECORDING_EVENT);
       ::Event::Manager::getInstance()->postEventRT(&event);
       recording = false;
     }
-    execute_mode = IDLE;
+    sequence_onFlag = false;
+    stim_onFlag = false;
+    pace_onFlag = false;
+    thresh_onFlag = false;
+    rrcProtocol_onFlag = false;
+    setMode(IDLE);
     setActive(false);
+    fileRecord_stop();
+    rrcUi.sequence_status_display->setText("Stopped");
   }
 }
 
-void RRC::Module::toggle_rrcThreshold() {
-  thresh_onFlag = rrcUi.rrcThreshold_button->isChecked();
+void RRC::Module::toggle_latency() {
+  latency_onFlag = rrcUi.latency_button->isChecked();
 
   // Make sure real-time thread is not in the middle of execution
   setActive(false);
   RRC_SyncEvent event;
   RT::System::getInstance()->postEvent(&event);
 
-  // Start protocol, reinitialize parameters to start values
-  if (thresh_onFlag) {
+  // Test pulses are not recorded, result is taken in refreshDisplay
+  if (latency_onFlag) {
     reset();
-    execute_mode = RRCTHRESHOLD;
-    thresh_previousAPD = -1;
-    thresh_rrcThreshFound = false;
-    thresh_rrcAmplitude = thresh_startAmplitude;
+    startMode(LATENCYTEST);
     setActive(true);
   }
-  else { // Called when in the middle of protocol
-    if (recording) {
-      ::Event::Object event(::Event::STOP_RECORDING_EVENT);
-      ::Event::Manager::getInstance()->postEventRT(&event);
-      recording = false;
-    }
-    execute_mode = IDLE;
+  else { // Called in the middle of test, keep previous measurement
+    output(0) = 0;
+    setMode(IDLE);
     setActive(false);
   }
-
 }
 
-void RRC::Module::toggle_rrcProtocol() {
-  rrcProtocol_onFlag = rrcUi.rrcProtocol_button->isChecked();
+void RRC::Module::toggle_capacitance() {
+  cm_onFlag = rrcUi.cm_button->isChecked();
 
   // Make sure real-time thread is not in the middle of execution
   setActive(false);
   RRC_SyncEvent event;
   RT::System::getInstance()->postEvent(&event);
 
-  // Start protocol, reinitialize parameters to start values
-  if (rrcProtocol_onFlag) {
+  // Test steps are not recorded, result is taken in refreshDisplay
+  if (cm_onFlag) {
     reset();
-    execute_mode = RRCPROTOCOL;
+    cm_nextMode = IDLE;
+    cm_probe.allocate(period);
+    startMode(CAPACITANCE);
     setActive(true);
   }
-  else { // Called when in the middle of protocol
-    if (recording) {
-      ::Event::Object event(::Event::STOP_RECORDING_EVENT);
-      ::Event::Manager::getInstance()->postEventRT(&event);
-      recording = false;
-    }
-    execute_mode = IDLE;
+  else { // Called in the middle of test, keep previous measurement
+    output(0) = 0;
+    setMode(IDLE);
     setActive(false);
   }
 }
 
+// Converts amplitudes to the units just chosen at the current Cm, so the
+// currents applied do not change
+void RRC::Module::toggle_density() {
+  bool density = rrcUi.amplitude_density_check->isChecked();
+  if (cm <= 0) {
+    QMessageBox::warning(this, "Amplitude Units",
+                         "Membrane capacitance must be set for pA/pF");
+    rrcUi.amplitude_density_check->setChecked(!density);
+    return;
+  }
+  convertAmplitudes(density);
+  modify();
+}
+
+// Converts amplitude edits to pA/pF, or back to nA, at the current Cm so
+// the applied currents do not change. Cm must be positive
+void RRC::Module::convertAmplitudes(bool density) {
+  // 1 nA = 1000 pA, divided by Cm (pF) gives pA/pF
+  double factor = density ? 1e3 / cm : cm * 1e-3;
+  QLineEdit *edits[] = {rrcUi.stim_amplitude_edit,
+                        rrcUi.thresh_startAmplitude_edit,
+                        rrcUi.thresh_ampIncrement_edit,
+                        rrcUi.rrc_amplitude_edit};
+  for (size_t i = 0; i < sizeof(edits) / sizeof(edits[0]); i++)
+    edits[i]->setText(QString::number(edits[i]->text().toDouble() * factor));
+}
+
+// Continues the protocol of the checkpoint file at the stimulus of the last
+// saved beat. Settings are the current ones, results carried by the protocol
+// (stimulus and RRC amplitudes, search progress) come from the checkpoint
+void RRC::Module::resumeProtocol() {
+  if (execute_mode != IDLE || sequence_onFlag) {
+    QMessageBox::warning(this, "Checkpoint",
+                         "Stop the running protocol before resuming");
+    return;
+  }
+
+  ProtocolState state;
+  if (checkpoint_file.isEmpty() ||
+      !readCheckpoint(checkpoint_file.toLocal8Bit().constData(), state)) {
+    QMessageBox::warning(this, "Checkpoint",
+                         "No checkpoint to resume in " + checkpoint_file);
+    return;
+  }
+
+  execute_mode_t mode = static_cast<execute_mode_t>(state.mode);
+  QPushButton *button;
+  bool recordData;
+  switch (mode) {
+    case PACE:
+      button = rrcUi.pace_button;
+      recordData = pace_recordData;
+      break;
+
+    case RRCTHRESHOLD:
+      button = rrcUi.rrcThreshold_button;
+      recordData = thresh_recordData;
+      break;
+
+    case RRCPROTOCOL:
+      button = rrcUi.rrcProtocol_button;
+      recordData = rrcProtocol_recordData;
+      break;
+
+    case S1S2RESTITUTION: // Written before restitution was left out
+    case DYNAMICRESTITUTION:
+      QMessageBox::warning(this, "Checkpoint",
+                           "Restitution protocols are not resumed");
+      return;
+
+    default:
+      QMessageBox::warning(this, "Checkpoint",
+                           "Checkpoint is not of a paced protocol");
+      return;
+  }
+  // Steps are matched by their content, the file may have been moved
+  if (state.sequenceStep >= 0 &&
+      (state.sequenceId != sequence_id ||
+       state.sequenceStep >= static_cast<int>(sequence_steps.size()) ||
+       state.sequenceMode != sequence_steps[state.sequenceStep].mode)) {
+    QMessageBox::warning(this, "Checkpoint",
+                         "Sequence of checkpoint is not loaded");
+    return;
+  }
+
+  // Make sure real-time thread is not in the middle of execution
+  setActive(false);
+  RRC_SyncEvent event;
+  RT::System::getInstance()->postEvent(&event);
+
+  reset();
+  startMode(mode);
+
+  // Results carried by the protocol
+  stim_amplitude = state.stimAmplitude;
+  stim_current = stim_amplitude * amplitude_scale;
+  rrc_amplitude = state.rrcAmplitude;
+  rrcUi.stim_amplitude_edit->setText(QString::number(stim_amplitude));
+  rrcUi.rrc_amplitude_edit->setText(QString::number(rrc_amplitude));
+  rrc_injectionAmplitude = state.rrcInjectionAmplitude;
+  thresh_rrcAmplitude = state.threshAmplitude;
+  thresh_previousAPD = state.threshPreviousApd;
+  thresh_maxAmplitude = state.threshMaxAmplitude;
+  rrc_random.seed(state.random);
+  rrc_random_injection = state.randomInjection;
+  rrc_random_threshold = state.randomThreshold;
+  pace_endBeat = state.paceEndBeat;
+
+  // Next tick is the stimulus of the saved beat
+  beatNumber = state.beatNumber;
+  beatNumber_int = state.beatNumber;
+  time = state.time;
+  calculateAPD(1);
+  time_int = static_cast<int>(std::floor(time / period + 0.5)) - 1;
+  bcl_startTime = time_int + 1;
+  time -= period;
+
+  // Statistics restart from the saved APDs
+  checkpoint_history = state.history;
+  int first = std::max(0, state.history.count - ApdHistory::size);
+  for (int i = first; i < state.history.count; i++) {
+    double beatApd = state.history.apds[i % ApdHistory::size];
+    stats_all.add(beatApd);
+    if (state.history.injections[i % ApdHistory::size] == BeatRecord::NONE)
+      stats_control.add(beatApd);
+    else
+      stats_injected.add(beatApd);
+  }
+  updateStatisticsDisplay();
+
+  if (state.sequenceStep >= 0) {
+    sequence_onFlag = true;
+    sequence_step = state.sequenceStep;
+    sequence_transitions = state.sequenceTransitions;
+    sequence_lastSuccess = true;
+    button = rrcUi.sequence_button;
+  }
+  button->setChecked(true);
+
+  // Recording continues in new files, data recorder starts with the beat
+  if (recordData || (sequence_onFlag &&
+                     (stim_recordData || pace_recordData ||
+                      thresh_recordData || rrcProtocol_recordData)))
+    fileRecord_start();
+  if (recordData)
+    dataRecord_start();
+  openCheckpoint();
+  setActive(true);
+}
+
+void RRC::Module::loadSequence() {
+  QString fileName = QFileDialog::getOpenFileName(this, "Load Sequence",
+                                                  sequence_file,
+                                                  "Text files (*.txt *.seq)");
+  if (fileName.isEmpty())
+    return;
+
+  if (sequence_onFlag) {
+    QMessageBox::warning(this, "Sequence",
+                         "Sequence cannot be loaded while running");
+    return;
+  }
+
+  if (readSequenceFile(fileName)) {
+    sequence_file = fileName;
+    rrcUi.sequence_file_display->setText(sequence_file);
+    rrcUi.sequence_status_display->setText(
+        QString::number(sequence_steps.size()) + " steps loaded");
+  }
+}
+
+// Parses a sequence script, see RRC_Sequence.h. Shows the problem and keeps
+// the current sequence if the file is not usable
+bool RRC::Module::readSequenceFile(const QString &fileName) {
+  std::ifstream file(fileName.toLocal8Bit().constData());
+  std::string error = "Unable to read file";
+  std::vector<SequenceStep> steps;
+
+  if (!file.is_open() || !parseSequence(file, steps, error)) {
+    QMessageBox::warning(this, "Sequence",
+                         fileName + ": " + QString::fromStdString(error));
+    return false;
+  }
+  sequence_steps.swap(steps);
+  sequence_id = sequenceId(sequence_steps);
+  return true;
+}
+
+void RRC::Module::loadRRCWaveform() {
+  QString fileName = QFileDialog::getOpenFileName(this, "Load RRC Waveform",
+                                                  rrc_waveformFile,
+                                                  "Text files (*.txt *.dat)");
+  if (fileName.isEmpty())
+    return;
+
+  bool active = getActive();
+  // Make sure real-time thread is not in the middle of execution
+  setActive(false);
+  RRC_SyncEvent event;
+  RT::System::getInstance()->postEvent(&event);
+
+  if (readRRCWaveformFile(fileName)) {
+    rrc_waveformFile = fileName;
+    rrcUi.rrc_waveformFile_display->setText(rrc_waveformFile);
+    compileRRCWaveform();
+  }
+  else
+    QMessageBox::warning(this, "RRC Waveform",
+                         "Unable to read waveform file " + fileName);
+
+  setActive(active);
+}
+
 // Event handling
+// Called after the RTXI period has changed. Tick counts were rescaled by
+// receiveEventRT(), what is sampled at the period is rebuilt here
 void RRC::Module::receiveEvent( const ::Event::Object *event ) {
+  if (event->getName() != ::Event::RT_POSTPERIOD_EVENT)
+    return;
+
+  bool active = getActive();
+  // Make sure real-time thread is not in the middle of execution
+  setActive(false);
+  RRC_SyncEvent sync;
+  RT::System::getInstance()->postEvent(&sync);
+
+  // In case the real-time event was missed
+  rescalePeriod(RT::System::getInstance()->getPeriod() * 1e-6);
+  export_memory.setPeriod(period);
+  compileRRCWaveform();
+
+  // Beats analyzed so far are logged, the beat being captured is dropped
+  beat_analyzer.wait();
+  updateBeatFeatures();
+  beat_analyzer.allocate(bcl / period + 1, period, overlay_beats);
+
+  // Trace files store a single period, recording continues in a new file
+  if (trace_sink->isOpen()) {
+    trace_sink->close();
+    openTrace(trace_file +
+              QDateTime::currentDateTime().toString("_yyyyMMdd_hhmmss"));
+  }
+
+  setActive(active);
 }
 
+// Called in the real-time thread before the first tick at a new period
 void RRC::Module::receiveEventRT( const ::Event::Object *event ) {
+  if (event->getName() == ::Event::RT_PERIOD_EVENT)
+    rescalePeriod(*static_cast<long long *>(event->getParam("period")) * 1e-6);
+}
+
+// RT. Rescales tick counts to a new period (ms), so the beat in progress and
+// pacing continue at the same times. The RRC window is kept inside the
+// waveform compiled at the old period until receiveEvent() recompiles it
+void RRC::Module::rescalePeriod(double newPeriod) {
+  if (newPeriod <= 0 || newPeriod == period)
+    return;
+
+  if (time_int >= 0) {
+    double beatTime = (time_int - bcl_startTime) * period;
+    time_int = static_cast<int>(std::floor(time / newPeriod + 0.5));
+    bcl_startTime = time_int -
+        static_cast<int>(std::floor(beatTime / newPeriod + 0.5));
+  }
+  period = newPeriod;
+
+  // Cycle length of beat in progress, restitution steps set their own
+  double cycle = bcl;
+  if (execute_mode == DYNAMICRESTITUTION ||
+      (execute_mode == S1S2RESTITUTION && rest_phase == REST_COUPLING))
+    cycle = rest_cycle;
+  bcl_int = cycle / period;
+  stim_length_int = stim_length / period;
+
+  rrc_startTime = stim_length_int + (rrc_delay / period);
+  if (rrc_length == 0)
+    rrc_endTime = bcl_int;
+  else
+    rrc_endTime = rrc_length / period;
+  int compiledEnd = rrc_startTime + 1 + static_cast<int>(rrc_waveform.size());
+  if (rrc_endTime > compiledEnd)
+    rrc_endTime = compiledEnd;
+
+  // Test pulses are counted in ticks, the latency test starts over
+  if (execute_mode == LATENCYTEST)
+    latency_probe.start(period);
+  // Averaged steps cannot be resized here, the capacitance test fails
+  if (execute_mode == CAPACITANCE)
+    cm_probe.abort();
 }
 
 // Settings loading and saving
+// Saved as settings_version. Settings saved without it lack the parameters
+// added since, which keep the defaults of initialize() when loaded
+static const int settingsVersion = 1;
+
 void RRC::Module::doLoad(const Settings::Object::State &s) {
   if (s.loadInteger("Maximized")) showMaximized();
   else if (s.loadInteger("Minimized")) showMinimized();
@@ -923,12 +2433,23 @@ void RRC::Module::doLoad(const Settings::Object::State &s) {
   }
 
   // Workspace parameters
+  int version = s.loadInteger("settings_version");
   //// Stimulus tab
   bcl = s.loadDouble("bcl");
   stim_amplitude = s.loadDouble("stim_amplitude");
   stim_length = s.loadDouble("stim_length");
   ljp = s.loadDouble("ljp");
   cm = s.loadDouble("cm");
+  latency_amplitude = s.loadDouble("latency_amplitude");
+  latency_ticks = s.loadInteger("latency_ticks");
+  cm_amplitude = s.loadDouble("cm_amplitude");
+  cm_beforePacing = s.loadInteger("cm_beforePacing");
+  amplitude_density = s.loadInteger("amplitude_density");
+  // Cm of settings saved without one, amplitudes can only be in nA
+  if (cm <= 0) {
+    cm = 100;
+    amplitude_density = false;
+  }
   //// RRC threshold tab
   thresh_startAmplitude = s.loadDouble("thresh_startAmplitude");
   thresh_ampIncrement = s.loadDouble("thresh_ampIncrement");
@@ -942,15 +2463,71 @@ void RRC::Module::doLoad(const Settings::Object::State &s) {
   rrc_beatNumber = s.loadInteger("rrc_beatNumber");
   rrc_chance = s.loadInteger("rrc_chance");
   rrc_endBeatNumber = s.loadInteger("rrc_endBeatNumber");
+  rrc_shape = static_cast<rrc_shape_t>(s.loadInteger("rrc_shape"));
+  rrc_tau = std::max(0.001, s.loadDouble("rrc_tau"));
+  rrc_waveformFile = QString::fromStdString(s.loadString("rrc_waveformFile"));
+  if (!rrc_waveformFile.isEmpty() && !readRRCWaveformFile(rrc_waveformFile))
+    QMessageBox::warning(this, "RRC Waveform",
+                         "Unable to read waveform file " + rrc_waveformFile);
   //// APD tab
   apd_repolPercent = s.loadInteger("apd_repolPercent");
   apd_min = s.loadInteger("apd_min");
   apd_stimWindow = s.loadInteger("apd_stimWindow");
+  if (version >= 1) {
+    apd_peakHold = s.loadDouble("apd_peakHold");
+    apd_upstrokeThreshold = s.loadDouble("apd_upstrokeThreshold");
+  }
+  analysis_decimation = std::max(1, s.loadInteger("analysis_decimation"));
+  //// Dynamic clamp tab
+  dc_model = static_cast<dc_model_t>(s.loadInteger("dc_model"));
+  dc_conductance = s.loadDouble("dc_conductance");
+  dc_ek = s.loadDouble("dc_ek");
+  //// Restitution tab
+  if (version >= 1) {
+    rest_protocol =
+        static_cast<rest_protocol_t>(s.loadInteger("rest_protocol"));
+    rest_step = s.loadDouble("rest_step");
+    rest_minBcl = s.loadDouble("rest_minBcl");
+    rest_tolerance = s.loadDouble("rest_tolerance");
+    rest_convergedBeats = s.loadInteger("rest_convergedBeats");
+    rest_maxBeats = s.loadInteger("rest_maxBeats");
+  }
+  //// Overlay tab
+  overlay_beats = s.loadInteger("overlay_beats");
+  //// Statistics tab
+  stats_window = s.loadInteger("stats_window");
+  //// Watchdog tab
+  if (version >= 1) { // 0 disables a check, so missing values cannot be 0
+    watchdog_vMin = s.loadDouble("watchdog_vMin");
+    watchdog_vMax = s.loadDouble("watchdog_vMax");
+    watchdog_rangeTime = s.loadDouble("watchdog_rangeTime");
+    watchdog_missedBeats = s.loadInteger("watchdog_missedBeats");
+    watchdog_stuckBeats = s.loadInteger("watchdog_stuckBeats");
+  }
   //// Data tab
   pace_recordData = s.loadInteger("pace_recordData");
   stim_recordData = s.loadInteger("stim_recordData");
   thresh_recordData = s.loadInteger("thresh_recordData");
   rrcProtocol_recordData = s.loadInteger("rrcProtocol_recordData");
+  sequence_file = QString::fromStdString(s.loadString("sequence_file"));
+  if (!sequence_file.isEmpty())
+    readSequenceFile(sequence_file);
+  rest_recordData = s.loadInteger("rest_recordData");
+  trace_format = static_cast<trace_format_t>(s.loadInteger("trace_format"));
+  trace_file = QString::fromStdString(s.loadString("trace_file"));
+  trace_voltageResolution = s.loadDouble("trace_voltageResolution");
+  trace_currentResolution = s.loadDouble("trace_currentResolution");
+  // Resolutions of settings saved without them
+  if (trace_voltageResolution <= 0)
+    trace_voltageResolution = 0.01;
+  if (trace_currentResolution <= 0)
+    trace_currentResolution = 1;
+  beatLog_enabled = s.loadInteger("beatLog_enabled");
+  control_path = QString::fromStdString(s.loadString("control_path"));
+  openControl();
+  export_name = QString::fromStdString(s.loadString("export_name"));
+  openExport();
+  checkpoint_file = QString::fromStdString(s.loadString("checkpoint_file"));
 
   // Set user interface values
   //// Stimulus tab
@@ -959,6 +2536,12 @@ void RRC::Module::doLoad(const Settings::Object::State &s) {
   rrcUi.stim_length_edit->setText(QString::number(stim_length));
   rrcUi.ljp_edit->setText(QString::number(ljp));
   rrcUi.cm_edit->setText(QString::number(cm));
+  rrcUi.latency_amplitude_edit->setText(QString::number(latency_amplitude));
+  updateLatencyDisplay();
+  rrcUi.cm_amplitude_edit->setText(QString::number(cm_amplitude));
+  rrcUi.cm_beforePacing_check->setChecked(cm_beforePacing);
+  rrcUi.amplitude_density_check->setChecked(amplitude_density);
+  updateAmplitudeUnits();
   //// RRC threshold tab
   rrcUi.thresh_startAmplitude_edit->
       setText(QString::number(thresh_startAmplitude));
@@ -973,15 +2556,57 @@ void RRC::Module::doLoad(const Settings::Object::State &s) {
   rrcUi.rrc_beatNumber_edit->setText(QString::number(rrc_beatNumber));
   rrcUi.rrc_chance_edit->setText(QString::number(rrc_chance));
   rrcUi.rrc_endBeatNumber_edit->setText(QString::number(rrc_endBeatNumber));
+  rrcUi.rrc_shape_comboBox->setCurrentIndex(rrc_shape);
+  rrcUi.rrc_tau_edit->setText(QString::number(rrc_tau));
+  rrcUi.rrc_waveformFile_display->setText(rrc_waveformFile);
   //// APD tab
   rrcUi.apd_repolPercent_edit->setText(QString::number(apd_repolPercent));
   rrcUi.apd_min_edit->setText(QString::number(apd_min));
   rrcUi.apd_stimWindow_edit->setText(QString::number(apd_stimWindow));
+  rrcUi.apd_peakHold_edit->setText(QString::number(apd_peakHold));
+  rrcUi.apd_upstrokeThreshold_edit->setText(
+      QString::number(apd_upstrokeThreshold));
+  rrcUi.analysis_decimation_edit->setText(
+      QString::number(analysis_decimation));
+  //// Dynamic clamp tab
+  rrcUi.dc_model_comboBox->setCurrentIndex(dc_model);
+  rrcUi.dc_conductance_edit->setText(QString::number(dc_conductance));
+  rrcUi.dc_ek_edit->setText(QString::number(dc_ek));
+  //// Restitution tab
+  rrcUi.rest_protocol_comboBox->setCurrentIndex(rest_protocol);
+  rrcUi.rest_step_edit->setText(QString::number(rest_step));
+  rrcUi.rest_minBcl_edit->setText(QString::number(rest_minBcl));
+  rrcUi.rest_tolerance_edit->setText(QString::number(rest_tolerance));
+  rrcUi.rest_convergedBeats_edit->setText(QString::number(rest_convergedBeats));
+  rrcUi.rest_maxBeats_edit->setText(QString::number(rest_maxBeats));
+  //// Overlay tab
+  rrcUi.overlay_beats_edit->setText(QString::number(overlay_beats));
+  //// Statistics tab
+  rrcUi.stats_window_edit->setText(QString::number(stats_window));
+  //// Watchdog tab
+  rrcUi.watchdog_vMin_edit->setText(QString::number(watchdog_vMin));
+  rrcUi.watchdog_vMax_edit->setText(QString::number(watchdog_vMax));
+  rrcUi.watchdog_rangeTime_edit->setText(QString::number(watchdog_rangeTime));
+  rrcUi.watchdog_missedBeats_edit->
+      setText(QString::number(watchdog_missedBeats));
+  rrcUi.watchdog_stuckBeats_edit->setText(QString::number(watchdog_stuckBeats));
   //// Data tab
   rrcUi.stimThreshold_dataCheck->setChecked(stim_recordData);
   rrcUi.pace_dataCheck->setChecked(pace_recordData);
   rrcUi.rrcThreshold_dataCheck->setChecked(thresh_recordData);
   rrcUi.rrcProtocol_dataCheck->setChecked(rrcProtocol_recordData);
+  rrcUi.restitution_dataCheck->setChecked(rest_recordData);
+  rrcUi.trace_format_comboBox->setCurrentIndex(trace_format);
+  rrcUi.trace_file_edit->setText(trace_file);
+  rrcUi.trace_voltageResolution_edit->
+      setText(QString::number(trace_voltageResolution));
+  rrcUi.trace_currentResolution_edit->
+      setText(QString::number(trace_currentResolution));
+  rrcUi.beatLog_dataCheck->setChecked(beatLog_enabled);
+  rrcUi.control_path_edit->setText(control_path);
+  rrcUi.export_name_edit->setText(export_name);
+  rrcUi.checkpoint_file_edit->setText(checkpoint_file);
+  rrcUi.sequence_file_display->setText(sequence_file);
 }
 
 void RRC::Module::doSave(Settings::Object::State &s) const {
@@ -998,12 +2623,18 @@ void RRC::Module::doSave(Settings::Object::State &s) const {
   s.saveInteger("H", subWindow->height());
 
   // Parameters
+  s.saveInteger("settings_version", settingsVersion);
   //// Stimulus Tab
   s.saveDouble("bcl", bcl);
   s.saveDouble("stim_amplitude", stim_amplitude);
   s.saveDouble("stim_length", stim_length);
   s.saveDouble("ljp", ljp);
   s.saveDouble("cm", cm);
+  s.saveDouble("latency_amplitude", latency_amplitude);
+  s.saveInteger("latency_ticks", latency_ticks);
+  s.saveDouble("cm_amplitude", cm_amplitude);
+  s.saveInteger("cm_beforePacing", cm_beforePacing);
+  s.saveInteger("amplitude_density", amplitude_density);
   //// RRC threshold tab
   s.saveDouble("thresh_startAmplitude", thresh_startAmplitude);
   s.saveDouble("thresh_ampIncrement", thresh_ampIncrement);
@@ -1017,14 +2648,51 @@ void RRC::Module::doSave(Settings::Object::State &s) const {
   s.saveInteger("rrc_beatNumber", rrc_beatNumber);
   s.saveInteger("rrc_chance", rrc_chance);
   s.saveInteger("rrc_endBeatNumber", rrc_endBeatNumber);
+  s.saveInteger("rrc_shape", rrc_shape);
+  s.saveDouble("rrc_tau", rrc_tau);
+  s.saveString("rrc_waveformFile", rrc_waveformFile.toStdString());
   //// APD tab
   s.saveInteger("apd_repolPercent", apd_repolPercent);
   s.saveInteger("apd_min", apd_min);
   s.saveInteger("apd_stimWindow", apd_stimWindow);
+  s.saveDouble("apd_peakHold", apd_peakHold);
+  s.saveDouble("apd_upstrokeThreshold", apd_upstrokeThreshold);
+  s.saveInteger("analysis_decimation", analysis_decimation);
+  //// Dynamic clamp tab
+  s.saveInteger("dc_model", dc_model);
+  s.saveDouble("dc_conductance", dc_conductance);
+  s.saveDouble("dc_ek", dc_ek);
+  //// Restitution tab
+  s.saveInteger("rest_protocol", rest_protocol);
+  s.saveDouble("rest_step", rest_step);
+  s.saveDouble("rest_minBcl", rest_minBcl);
+  s.saveDouble("rest_tolerance", rest_tolerance);
+  s.saveInteger("rest_convergedBeats", rest_convergedBeats);
+  s.saveInteger("rest_maxBeats", rest_maxBeats);
+  //// Overlay tab
+  s.saveInteger("overlay_beats", overlay_beats);
+  //// Statistics tab
+  s.saveInteger("stats_window", stats_window);
+  //// Watchdog tab
+  s.saveDouble("watchdog_vMin", watchdog_vMin);
+  s.saveDouble("watchdog_vMax", watchdog_vMax);
+  s.saveDouble("watchdog_rangeTime", watchdog_rangeTime);
+  s.saveInteger("watchdog_missedBeats", watchdog_missedBeats);
+  s.saveInteger("watchdog_stuckBeats", watchdog_stuckBeats);
   //// Data tab
   s.saveInteger("stim_recordData", rrcUi.stimThreshold_dataCheck->isChecked());
   s.saveInteger("pace_recordData", rrcUi.pace_dataCheck->isChecked());
   s.saveInteger("thresh_recordData", rrcUi.rrcThreshold_dataCheck->isChecked());
   s.saveInteger("rrcProtocol_recordData",
                 rrcUi.rrcProtocol_dataCheck->isChecked());
+  s.saveInteger("rest_recordData", rrcUi.restitution_dataCheck->isChecked());
+  s.saveString("sequence_file", sequence_file.toStdString());
+  s.saveInteger("trace_format", trace_format);
+  s.saveString("trace_file", trace_file.toStdString());
+  s.saveDouble("trace_voltageResolution", trace_voltageResolution);
+  s.saveDouble("trace_currentResolution", trace_currentResolution);
+  s.saveInteger("beatLog_enabled", beatLog_enabled);
+  s.saveString("control_path", control_path.toStdString());
+  s.saveString("export_name", export_name.toStdString());
+  s.saveString("checkpoint_file", checkpoint_file.toStdString());
 }
@@ -2,6 +2,23 @@
 #define RRC_H
 
 #include "RRC_MainWindow_UI.h"
+#include "RRC_APD.h"
+#include "RRC_Trace.h"
+#include "RRC_CompressedTrace.h"
+#include "RRC_Features.h"
+#include "RRC_Statistics.h"
+#include "RRC_Restitution.h"
+#include "RRC_Sequence.h"
+#include "RRC_Control.h"
+#include "RRC_Export.h"
+#include "RRC_Watchdog.h"
+#include "RRC_Latency.h"
+#include "RRC_Capacitance.h"
+#include "RRC_Modes.h"
+#include "RRC_Protocol.h"
+#include "RRC_Decimator.h"
+#include "RRC_Random.h"
+#include "RRC_Checkpoint.h"
 
 #include <rt.h>
 #include <settings.h>
@@ -12,12 +29,46 @@
 #include <QtGlobal>
 #include <QtWidgets>
 
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
 namespace RRC {
+// Plot of the last beats aligned to stimulus onset. Injected beats of the RRC
+// protocol are highlighted, sub-threshold blue and supra-threshold red
+class OverlayPlot : public QWidget {
+ public:
+  explicit OverlayPlot(QWidget *parent);
+  // Copies beats and redraws only if a new beat was added to overlay
+  void refresh(BeatOverlay &overlay, double period);
+
+ protected:
+  void paintEvent(QPaintEvent *);
+
+ private:
+  std::vector<BeatRecord> beats; // Oldest first
+  std::vector<double> samples; // Waveforms, samplesPerBeat apart
+  size_t samplesPerBeat;
+  double period; // Sample period (ms)
+}; // Class OverlayPlot
+
 class Module: public QWidget, public RT::Thread, public Plugin::Object,
               public Workspace::Instance, public Event::Handler,
               public Event::RTHandler {
   Q_OBJECT // Required macro for QT slots
 
+  // Protocol modes run the module's execute variables
+  template <typename> friend struct PacedMode;
+  friend struct PaceMode;
+  friend struct RRCThresholdMode;
+  friend struct RRCProtocolMode;
+  friend struct RestitutionMode;
+  friend struct StimThresholdMode;
+  friend struct LatencyMode;
+  friend struct CapacitanceMode;
+  friend struct Protocol;
+
  public:
   Module();
   ~Module();
@@ -28,23 +79,30 @@ class Module: public QWidget, public RT::Thread, public Plugin::Object,
  public slots:
   void refreshDisplay(); // Refresh user interface
   void modify(); // Update parameters
-  void toggle_stimThreshold(); // Called when stim threshold button is pressed
-  void toggle_pace(); // Called when pace button is pressed
-  void toggle_rrcThreshold(); // Called when RRC threshold button is pressed
-  void toggle_rrcProtocol(); // Called when RRC protocol button is pressed
+  void toggle_mode(); // Called when a protocol button is pressed
+  void toggle_density(); // Called when amplitude units are changed
+  void resumeProtocol(); // Called when resume button is pressed
+  void loadSequence(); // Called when sequence load button is pressed
+  void loadRRCWaveform(); // Called when RRC waveform load button is pressed
 
  private:
   // Ui elements
   QWidget *rrcWindow;
   QMdiSubWindow *subWindow;
   Ui::RRC_UI rrcUi;
+  OverlayPlot *overlay_plot;
 
   // Module functions
   void createGUI();
   void initialize();
   void reset();
+  void restart();
   void dataRecord_start();
   void dataRecord_stop();
+  void fileRecord_start();
+  void fileRecord_stop();
+  void openTrace(const QString &);
+  void rescalePeriod(double);
 
   // Workspace variables
   //// States
@@ -52,30 +110,70 @@ class Module: public QWidget, public RT::Thread, public Plugin::Object,
   double voltage; // Membrane voltage of cell (mV)
   double beatNumber; // Beats elapsed during protocol
   double apd; // Action potential duration (ms)
+  double dc_current; // Dynamic clamp current injected (nA)
+  double feature_maxDvdt; // Maximum dV/dt of last analyzed beat (mV/ms)
+  double feature_upstrokeVelocity; // Upstroke velocity of last beat (mV/ms)
+  double feature_peakVoltage; // Peak overshoot of last beat (mV)
+  double feature_plateauVoltage; // Plateau level of last beat (mV)
+  double feature_triangulation; // APD90 - APD30 of last beat (ms)
+  double feature_restingDrift; // Change in resting Vm from previous beat (mV)
   // Parameters
   //// Stimulus tab
   double bcl; // Basic cycle length (ms)
-  double stim_amplitude; // Stimulus amplitude (nA)
+  double stim_amplitude; // Stimulus amplitude (nA or pA/pF)
   double stim_length; // Stimulus length (ms)
   double ljp; // Liquid junction potential (mV)
   double cm; // Membrane capacitance (pF)
+  double latency_amplitude; // Amplitude of latency test pulses (nA)
+  double cm_amplitude; // Amplitude of capacitance test steps (nA)
+  bool cm_beforePacing; // Flag to measure Cm before each protocol
+  bool amplitude_density; // Flag to denote amplitudes are in pA/pF
   //// RRC threshold tab
-  double thresh_startAmplitude; // Start amplitude for RRC threshold test (nA)
-  double thresh_ampIncrement; // Increment amplitude of RRC threshold test (nA)
+  double thresh_startAmplitude; // Start amplitude of RRC threshold test
+  double thresh_ampIncrement; // Amplitude increment of RRC threshold test
   int thresh_beatNumber; // Number of beats before each RRC injection
   int thresh_apdCutoff; // APD change that denotes end of RRC threshold test
   //// RRC protocol tab
-  double rrc_amplitude; // Amplitude of repolarization reserve current (nA)
+  double rrc_amplitude; // Amplitude of repolarization reserve current
   double rrc_delay; // Delay before the start of RRC injection (ms)
   int rrc_length; // Length of RRC, where 0 indicates until next stimulus
   int rrc_thresholdWindow; // Change in amplitude for sub- and supra-threshold
   int rrc_beatNumber; // Number of beats before each RRC injection
   int rrc_chance; // Random chance for either a sub- or supra-threshold RRC
   int rrc_endBeatNumber; // Number of total beats for RRC injection protocol
+  enum rrc_shape_t {RRC_SQUARE, RRC_RAMP, RRC_EXPONENTIAL, RRC_FILE}
+    rrc_shape; // Waveform of RRC injection
+  double rrc_tau; // Decay time constant of exponential RRC injection (ms)
+  QString rrc_waveformFile; // File of RRC waveform, used with RRC_FILE shape
   //// APD tab
   int apd_repolPercent; // Action potential duration repolarization percentage
   int apd_min; // Minimum duration of depolarization that counts as AP (ms)
   int apd_stimWindow; // Window of time after stimulus ignored
+  double apd_peakHold; // Time peak must hold to account for noise (ms)
+  double apd_upstrokeThreshold; // Voltage that denotes start of AP (mV)
+  int analysis_decimation; // Ticks averaged into each analysis sample
+  //// Dynamic clamp tab
+  enum dc_model_t {DC_OFF, DC_IKR, DC_IK1} dc_model; // Modeled current
+  double dc_conductance; // Conductance of modeled current, < 0 blocks (nS)
+  double dc_ek; // Potassium reversal potential of modeled current (mV)
+  //// Restitution tab
+  enum rest_protocol_t {REST_S1S2, REST_DYNAMIC}
+    rest_protocol; // Restitution protocol started by restitution button
+  double rest_step; // Decrement of BCL or S1-S2 interval per step (ms)
+  double rest_minBcl; // Shortest BCL or S1-S2 interval (ms)
+  double rest_tolerance; // APD change between beats considered converged (ms)
+  int rest_convergedBeats; // Consecutive converged beats that end a step
+  int rest_maxBeats; // Beats that end a step without convergence
+  //// Overlay tab
+  int overlay_beats; // Number of last beats shown in overlay plot
+  //// Statistics tab
+  int stats_window; // Beats used by STV and alternans
+  //// Watchdog tab
+  double watchdog_vMin; // Lowest voltage allowed (mV)
+  double watchdog_vMax; // Highest voltage allowed (mV)
+  double watchdog_rangeTime; // Time out of range that stops protocol (ms)
+  int watchdog_missedBeats; // Consecutive beats without AP that stop protocol
+  int watchdog_stuckBeats; // Stimuli before repolarization that stop protocol
 
   // Int conversions to prevent rounding errors;
   int time_int;
@@ -87,12 +185,33 @@ class Module: public QWidget, public RT::Thread, public Plugin::Object,
   // Execute variables
   double outputCurrent;
   double period; // RTXI thread period
-  enum execute_mode_t {IDLE, STIMTHRESHOLD, PACE, RRCTHRESHOLD, RRCPROTOCOL}
-    execute_mode;
+  enum execute_mode_t {IDLE, STIMTHRESHOLD, PACE, RRCTHRESHOLD, RRCPROTOCOL,
+                       S1S2RESTITUTION, DYNAMICRESTITUTION,
+                       LATENCYTEST, CAPACITANCE} execute_mode;
+  void (*execute_tick)(Module &); // Tick of execute_mode, called through
+                                  // this pointer, see RRC_Modes.h
+  void setMode(execute_mode_t);
+  double amplitude_scale; // Current per amplitude unit (A per nA or pA/pF)
+  double stim_current; // Stimulus current (A)
   bool recording; // Flag to denote if data recorder is recording
+  //// Trace file
+  enum trace_format_t {TRACE_OFF, TRACE_RAW, TRACE_COMPRESSED}
+    trace_format; // Trace file type
+  QString trace_file; // Trace file prefix, timestamp added for each protocol
+  double trace_voltageResolution; // Amplifier voltage resolution (mV)
+  double trace_currentResolution; // Amplifier current resolution (pA)
+  TraceWriter trace_writer; // Writes raw ticks from non-RT thread
+  CompressedTraceWriter trace_compressedWriter; // Writes compressed ticks
+  TraceSink *trace_sink; // Writer of current trace file
+  int trace_beatOffset; // Beats of earlier sequence steps, keeps trace beats
+                        // increasing across the restarts of a sequence
+  //// Beat log
+  bool beatLog_enabled; // Flag to denote if beat features are logged
+  std::ofstream beatLog_file; // Per-beat features of current protocol
   //// Pace
   bool pace_onFlag; // Flag to denote state of pace button
   bool pace_recordData; // Flag to denote if data will be recorded
+  int pace_endBeat; // Beat that ends pacing of a sequence step, 0 for none
   int bcl_startTime; // Start time tracker for basic cycle length
   int bcl_stepTime;
   //// Stimulus Threshold
@@ -105,12 +224,14 @@ class Module: public QWidget, public RT::Thread, public Plugin::Object,
   double stim_responseTime;
   double stim_startTime;
   double stim_stimulusLevel;
+  double stim_maxLevel; // Stimulus that fails search (nA), 0 for none
   //// RRC Threshold
   bool thresh_onFlag; // Flag to denote state of RRC threshold button
   bool thresh_recordData; // Flag to denote if data will be recorded
   bool thresh_rrcThreshFound; // Flag to denote if search has completed
   double thresh_previousAPD; // Holder for APD during a RRC injection
   double thresh_rrcAmplitude;
+  double thresh_maxAmplitude; // Amplitude that fails search, 0 for none
   //// RRC Protocol
   bool rrcProtocol_onFlag; // Flag to denote state of pace button
   bool rrcProtocol_recordData; // Flag to denote if data will be recorded
@@ -118,17 +239,122 @@ class Module: public QWidget, public RT::Thread, public Plugin::Object,
   int rrc_endTime; // End time for RRC injection
   int rrc_random_injection;
   int rrc_random_threshold;
+  Random rrc_random; // Draws of RRC protocol, state is checkpointed
+  double rrc_injectionAmplitude; // Amplitude of RRC injection this beat (A)
+  std::vector<double> rrc_waveform; // RRC waveform sampled at RTXI period
+  std::vector<double> rrc_fileTime; // Time points of waveform file (ms)
+  std::vector<double> rrc_fileValue; // Relative amplitude of waveform file
+  void compileRRCWaveform();
+  bool readRRCWaveformFile(const QString &);
+  //// Restitution
+  bool rest_onFlag; // Flag to denote state of restitution button
+  bool rest_recordData; // Flag to denote if data will be recorded
+  enum rest_phase_t {REST_PACING, REST_COUPLING, REST_TEST}
+    rest_phase; // Beat of S1-S2 step, dynamic restitution only paces
+  double rest_cycle; // BCL or S1-S2 interval of current step (ms)
+  double rest_previousAPD; // APD of previous beat, -1 if none
+  double rest_s1APD; // APD of last S1 beat, sets DI of S2 beat
+  int rest_stableBeats; // Consecutive beats with APD within tolerance
+  int rest_stepBeats; // Beats paced in current step
+  RingBuffer<RestitutionPoint> rest_points; // Points from RT thread to GUI
+  RestitutionFit rest_fit; // Fit of points received by GUI
+  std::ofstream rest_file; // Restitution curve of current protocol
+  bool restitutionBeat();
+  void startRestitutionStep(double);
+  void addRestitutionPoint(double, double);
+  void updateRestitution();
+  //// Sequence
+  bool sequence_onFlag; // Flag to denote a sequence is running
+  QString sequence_file; // Script of sequence steps
+  std::vector<SequenceStep> sequence_steps; // Parsed script
+  int sequence_step; // Step being run
+  int sequence_transitions; // Steps started, limited to stop loops
+  bool sequence_lastSuccess; // Result of last finished step
+  uint32_t sequence_id; // sequenceId() of sequence_steps
+  bool readSequenceFile(const QString &);
+  void startMode(execute_mode_t);
+  void toggleMode(execute_mode_t, bool, bool);
+  // Protocol buttons, only one of them can be checked at a time
+  struct ModeButton {
+    const char *name; // Name of mode in control API
+    QPushButton *button;
+    bool *onFlag; // Flag to denote the mode is running
+    execute_mode_t mode; // Mode started by toggleMode()
+    bool *recordData; // Flag to denote data is recorded, 0 if never
+    void (Module::*toggle)(); // Starts or stops the mode, 0 for toggleMode()
+  };
+  std::vector<ModeButton> mode_buttons;
+  const ModeButton *modeButton(const std::string &) const;
+  void toggle_restitution(); // Called when restitution button is pressed
+  void toggle_sequence(); // Called when sequence button is pressed
+  void toggle_latency(); // Called when response latency button is pressed
+  void toggle_capacitance(); // Called when measure Cm button is pressed
+  void protocolDone(bool);
+  void startSequenceStep(int);
+  //// Control socket
+  QString control_path; // Unix socket of control API, empty for none
+  ControlServer control_server;
+  std::map<std::string, QWidget *> control_params; // Parameter widgets
+  void openControl();
+  void updateControl();
+  std::string controlCommand(int, const std::string &);
+  std::string controlGet(const std::string &) const;
+  std::string controlSet(std::istream &);
+  //// Checkpoint
+  QString checkpoint_file; // Checkpoint of running protocol, empty for none
+  CheckpointWriter checkpoint_writer; // Saves states from RT thread
+  ApdHistory checkpoint_history; // APDs of last beats, for statistics
+  void openCheckpoint();
+  void checkpointBeat();
+  //// Live export
+  QString export_name; // Shared memory object of live export, empty for none
+  SharedExport export_memory; // Samples from RT thread, beats from GUI
+  void openExport();
 
-  // APD calculation
+  // APD calculation, on samples decimated to the analysis rate
   void calculateAPD(int);
-  enum apd_mode_t {START, PEAK, DOWN, DONE} apd_mode;
-  double apd_vmRest; // Resting membrane potential, i.e. Vm prior to stimulus
-  double apd_upstrokeThreshold; // Upstroke threshold for start of AP
-  double apd_downstrokeThreshold; // Downstroke threshold for end of AP
-  double apd_startTime; // Time the action potential starts
-  double apd_peakTime; // Time of action potential peak
-  double apd_peakVoltage; // Voltage of action potential peak
-  double apd_endTime; // Time of action potential end
+  APDDetector apd_detector;
+  Decimator analysis_decimator;
+
+  // Beat morphology, computed by analyzer worker thread
+  void captureBeat();
+  int beatInjection();
+  void updateBeatFeatures();
+  BeatAnalyzer beat_analyzer;
+  double beat_apd; // APD found during current beat, -1 if not found yet
+  bool beat_open; // Flag to denote a beat is handed over at next stimulus
+  int beat_injection; // RRC injection of current beat, see BeatRecord
+
+  // Beat-to-beat APD statistics, injected beats are RRC injections
+  void updateStatisticsDisplay();
+  BeatStatistics stats_all;
+  BeatStatistics stats_control;
+  BeatStatistics stats_injected;
+
+  // Safety watchdog, stops protocol and output in the tick it trips
+  void watchdogTrip();
+  Watchdog watchdog;
+  bool watchdog_tripped; // Set by RT thread, cleared when GUI reports trip
+
+  // Response latency, measured by test pulses
+  bool latency_onFlag; // Flag to denote latency test is running
+  int latency_ticks; // Measured latency, 0 if not measured (ticks)
+  LatencyProbe latency_probe;
+  void updateLatencyDisplay();
+
+  // Membrane capacitance, measured by test steps alone or before a protocol
+  bool cm_onFlag; // Flag to denote capacitance test is running
+  execute_mode_t cm_nextMode; // Protocol started after test, IDLE for none
+  bool cm_nextRecordData; // Flag to denote next protocol records data
+  CapacitanceProbe cm_probe;
+  bool updateCapacitance();
+  void updateAmplitudeUnits();
+  void convertAmplitudes(bool density);
+
+  // Dynamic clamp
+  double calculateDynamicClamp();
+  double dc_xr1; // IKr activation gate
+  double dc_xr2; // IKr inactivation gate
 
  protected:
   void doLoad(const Settings::Object::State &);
@@ -0,0 +1,111 @@
+#ifndef RRC_APD_H
+#define RRC_APD_H
+
+// Action potential duration detector. Kept free of RTXI and Qt so the module
+// and the offline tools run exactly the same detection code.
+namespace RRC {
+class APDDetector {
+ public:
+  enum mode_t {START, PEAK, DOWN, DONE};
+
+  APDDetector() :
+      repolPercent(90), stimWindow(4), peakHold(5), upstrokeThreshold(-40),
+      minApd(0), mode(DONE), vmRest(0), downstrokeThreshold(0), stimTime(0),
+      startTime(0), peakTime(0), peakVoltage(0), endTime(0), apd(0) {}
+
+  // Restart AP search, vmRest is the membrane potential prior to stimulus
+  void start(double time, double voltage) {
+    mode = START;
+    stimTime = time;
+    vmRest = voltage;
+  }
+
+  // Called at each stimulus. If AP has not ended before new stimulus, do not
+  // restart APD calculation
+  void beat(double time, double voltage) {
+    if (mode != DOWN)
+      start(time, voltage);
+  }
+
+  // Called every sample. Returns true on the sample the beat's APD is found,
+  // which is 0 if the stimulus failed to produce an AP
+  bool step(double time, double voltage) {
+    switch(mode) {
+      // Find time membrane voltage passes upstroke threshold, start of AP
+      case START:
+        if (voltage >= upstrokeThreshold) {
+          startTime = time;
+          peakVoltage = vmRest;
+          mode = PEAK;
+        }
+        // If stimulus fails to produce an AP, set APD to 0
+        else if ((time - stimTime) > 2 * stimWindow) {
+          mode = DONE;
+          apd = 0;
+          return true;
+        }
+        break;
+
+        // Find peak of AP, points within "window" are ignored to eliminate
+        // effect of stimulus artifact
+      case PEAK:
+        // If we are outside the chosen time window after the AP
+        if ((time - startTime) > stimWindow) {
+          if (peakVoltage < voltage) { // Find peak voltage
+            peakVoltage = voltage;
+            peakTime = time;
+          }
+          // Keep looking for the peak to account for noise
+          else if ((time - peakTime) > peakHold) {
+            // Amplitude of action potential based on resting membrane
+            // and peak voltage
+            double amplitude = peakVoltage - vmRest;
+
+            // Calculate downstroke threshold based on AP amplitude and
+            // desired AP repolarization %
+            downstrokeThreshold =
+                peakVoltage - (amplitude * (repolPercent / 100.0));
+            mode = DOWN;
+          }
+        }
+        break;
+
+      case DOWN: // Find downstroke threshold and calculate APD
+        if (voltage <= downstrokeThreshold) {
+          endTime = time;
+          apd = time - startTime;
+          // Depolarization too short to be an action potential
+          if (apd < minApd)
+            apd = 0;
+          mode = DONE;
+          return true;
+        }
+        break;
+
+      default: // DONE: APD has been found, do nothing
+        break;
+    }
+    return false;
+  }
+
+  // Settings
+  int repolPercent; // Action potential duration repolarization percentage
+  int stimWindow; // Window of time after upstroke ignored by peak search (ms)
+  double peakHold; // Time peak must hold to account for noise (ms)
+  double upstrokeThreshold; // Upstroke threshold for start of AP (mV)
+  double minApd; // Shorter depolarizations are not APs, APD is 0 (ms)
+
+  // Detector state
+  mode_t mode;
+  double vmRest; // Resting membrane potential, i.e. Vm prior to stimulus
+  double downstrokeThreshold; // Downstroke threshold for end of AP
+  double stimTime; // Time of stimulus that started AP search
+  double startTime; // Time the action potential starts
+  double peakTime; // Time of action potential peak
+  double peakVoltage; // Voltage of action potential peak
+  double endTime; // Time of action potential end
+  double apd; // Action potential duration (ms)
+}; // Class APDDetector
+}; // Namespace RRC
+
+#endif // RRC_APD_H
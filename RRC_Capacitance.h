@@ -0,0 +1,155 @@
+#ifndef RRC_CAPACITANCE_H
+#define RRC_CAPACITANCE_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Measures membrane capacitance from the voltage response to small current
+// steps. Responses are averaged over the steps, each relative to the quiet
+// baseline before it, and fitted as a charging RC membrane:
+//   dV(t) = I * Rm * (1 - exp(-t / tau)),  Cm = tau / Rm
+// Steady state is the mean of the last fifth of the step. tau is the slope of
+// ln(1 - dV / dVss) between 10% and 90% of the steady state, fitted with an
+// intercept so the loop latency does not bias it.
+namespace RRC {
+class CapacitanceProbe {
+ public:
+  CapacitanceProbe() :
+      pulses(5), baselineTime(20), stepTime(200), restTime(300) {
+    allocate(0.1);
+  }
+
+  // Non-RT, sizes the averaged response for period (ms)
+  void allocate(double period) {
+    this->period = period;
+    baselineTicks = std::max(1, static_cast<int>(baselineTime / period));
+    stepTicks = std::max(1, static_cast<int>(stepTime / period));
+    restTicks = std::max(1, static_cast<int>(restTime / period));
+    response.assign(stepTicks, 0);
+    phase = DONE;
+    completed = 0;
+  }
+
+  // RT, steps are counted in ticks of the period given to allocate()
+  void start() {
+    std::fill(response.begin(), response.end(), 0.0);
+    phase = BASELINE;
+    tick = 0;
+    pulse = 0;
+    completed = 0;
+    sum = 0;
+  }
+
+  // RT. Ends the measurement without a result
+  void abort() {
+    phase = DONE;
+    completed = 0;
+  }
+
+  // RT. Called every tick with the input of the tick, returns true while the
+  // output step should be on
+  bool step(double voltage) {
+    switch (phase) {
+      case BASELINE:
+        sum += voltage;
+        if (++tick >= baselineTicks) {
+          mean = sum / tick;
+          phase = STEP;
+          tick = 0;
+          return true; // Output of first step tick is set here
+        }
+        return false;
+
+      case STEP:
+        response[tick] += voltage - mean;
+        if (++tick >= stepTicks) {
+          completed++;
+          phase = REST;
+          tick = 0;
+          return false;
+        }
+        return true;
+
+      case REST: // Lets the membrane recover before the next baseline
+        if (++tick >= restTicks) {
+          tick = 0;
+          sum = 0;
+          phase = ++pulse < pulses ? BASELINE : DONE;
+        }
+        return false;
+
+      default: // DONE
+        return false;
+    }
+  }
+
+  bool done() const { return phase == DONE; }
+
+  // Non-RT, after done(). amplitude of the steps (nA), gives Cm (pF), Rm (MOhm)
+  // and tau (ms). Returns false if the response does not fit an RC membrane
+  // or does not settle within the step
+  bool fit(double amplitude, double &cm, double &rm, double &tau) const {
+    if (!done() || completed == 0 || amplitude == 0)
+      return false;
+
+    int tail = std::max(1, stepTicks / 5);
+    double steady = 0;
+    for (int i = stepTicks - tail; i < stepTicks; i++)
+      steady += response[i];
+    steady /= tail * static_cast<double>(completed);
+    if (steady / amplitude <= 0) // No response, or of the wrong sign
+      return false;
+
+    // Least squares line of ln(1 - dV / dVss) against time
+    int n = 0;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (int i = 0; i < stepTicks - tail; i++) {
+      double fraction = response[i] / completed / steady;
+      if (fraction < 0.1 || fraction > 0.9)
+        continue;
+      double x = (i + 1) * period;
+      double y = std::log(1 - fraction);
+      n++;
+      sx += x;
+      sy += y;
+      sxx += x * x;
+      sxy += x * y;
+    }
+    double denominator = n * sxx - sx * sx;
+    if (n < 3 || denominator <= 0)
+      return false;
+    double slope = (n * sxy - sx * sy) / denominator;
+    if (slope >= 0)
+      return false;
+
+    tau = -1 / slope;
+    if (3 * tau > stepTime) // Not settled, steady state is underestimated
+      return false;
+    rm = steady / amplitude; // mV / nA = MOhm
+    cm = tau / rm * 1e3; // ms / MOhm = nF, convert to pF
+    return true;
+  }
+
+  // Settings, applied by allocate()
+  int pulses; // Steps averaged
+  double baselineTime; // Quiet time before each step (ms)
+  double stepTime; // Length of each step (ms)
+  double restTime; // Time after each step (ms)
+
+ private:
+  enum phase_t {BASELINE, STEP, REST, DONE} phase;
+  double period; // ms
+  int baselineTicks;
+  int stepTicks;
+  int restTicks;
+  int tick; // Ticks in current phase
+  int pulse; // Steps applied
+  int completed; // Steps whose response was fully recorded
+  double sum; // Baseline voltage sum
+  double mean; // Baseline of current step
+  std::vector<double> response; // Summed response of each step tick (mV)
+}; // Class CapacitanceProbe
+}; // Namespace RRC
+
+#endif // RRC_CAPACITANCE_H
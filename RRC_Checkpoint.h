@@ -0,0 +1,270 @@
+#ifndef RRC_CHECKPOINT_H
+#define RRC_CHECKPOINT_H
+
+#include "RRC_RingBuffer.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+
+// Checkpoints of a running protocol, so it can be resumed after a crash.
+// The real-time thread takes a ProtocolState at the stimulus of each beat
+// and a writer thread saves the latest one at most once per interval. A
+// checkpoint is written to a temporary file, synced and renamed over the
+// previous one, so the file always holds a complete checkpoint. Files are
+// name value lines, readable and stable across builds.
+namespace RRC {
+// APDs of the last beats with an AP, from which beat statistics are rebuilt
+struct ApdHistory {
+  static const int size = 64;
+
+  void clear() { count = 0; }
+
+  void add(double apd, int injection) {
+    apds[count % size] = apd;
+    injections[count % size] = injection;
+    count++;
+  }
+
+  int count; // APDs added, the last size are kept
+  double apds[size]; // ms
+  int32_t injections[size]; // BeatRecord injection of each beat
+}; // Struct ApdHistory
+
+// State of a paced protocol at the stimulus of a beat, before the beat runs
+struct ProtocolState {
+  int32_t mode; // execute_mode_t of module
+  int32_t beatNumber; // Beat starting at this stimulus
+  double time; // Protocol time of stimulus (ms)
+  double cycle; // Cycle length of this beat (ms)
+  double stimAmplitude; // In amplitude units of module
+  double rrcAmplitude; // In amplitude units of module
+  double rrcInjectionAmplitude; // Injection of this beat (A)
+  // RRC threshold search
+  double threshAmplitude;
+  double threshPreviousApd;
+  double threshMaxAmplitude;
+  // RRC protocol
+  uint32_t random; // Random state after draws of this beat
+  int32_t randomInjection;
+  int32_t randomThreshold;
+  // Pacing
+  int32_t paceEndBeat;
+  // Sequence, step is -1 without a sequence
+  int32_t sequenceStep;
+  int32_t sequenceTransitions;
+  uint32_t sequenceId; // sequenceId() of loaded steps, 0 without a sequence
+  int32_t sequenceMode; // SequenceStep mode of step, -1 without a sequence
+  ApdHistory history;
+}; // Struct ProtocolState
+
+// Writes state to fileName with an atomic rename. Non-RT
+inline bool writeCheckpoint(const std::string &fileName,
+                            const ProtocolState &s) {
+  std::ostringstream text;
+  text.precision(std::numeric_limits<double>::digits10 + 2);
+  text << "# RRC protocol checkpoint\n"
+       << "version 2\n"
+       << "mode " << s.mode << '\n'
+       << "beat " << s.beatNumber << '\n'
+       << "time " << s.time << '\n'
+       << "cycle " << s.cycle << '\n'
+       << "stim_amplitude " << s.stimAmplitude << '\n'
+       << "rrc_amplitude " << s.rrcAmplitude << '\n'
+       << "rrc_injection " << s.rrcInjectionAmplitude << '\n'
+       << "thresh_amplitude " << s.threshAmplitude << '\n'
+       << "thresh_previous_apd " << s.threshPreviousApd << '\n'
+       << "thresh_max " << s.threshMaxAmplitude << '\n'
+       << "random " << s.random << '\n'
+       << "random_injection " << s.randomInjection << '\n'
+       << "random_threshold " << s.randomThreshold << '\n'
+       << "pace_end_beat " << s.paceEndBeat << '\n'
+       << "sequence_step " << s.sequenceStep << '\n'
+       << "sequence_transitions " << s.sequenceTransitions << '\n'
+       << "sequence_id " << s.sequenceId << '\n'
+       << "sequence_mode " << s.sequenceMode << '\n'
+       << "apd_count " << s.history.count << '\n';
+  // Oldest kept APD first
+  int first = s.history.count > ApdHistory::size ?
+      s.history.count - ApdHistory::size : 0;
+  for (int i = first; i < s.history.count; i++)
+    text << "apd " << s.history.apds[i % ApdHistory::size] << ' '
+         << s.history.injections[i % ApdHistory::size] << '\n';
+
+  std::string temporary = fileName + ".tmp";
+  int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return false;
+  std::string data = text.str();
+  const char *p = data.data();
+  size_t bytes = data.size();
+  while (bytes > 0) {
+    ssize_t written = ::write(fd, p, bytes);
+    if (written < 0) {
+      ::close(fd);
+      return false;
+    }
+    p += written;
+    bytes -= written;
+  }
+  bool ok = fsync(fd) == 0;
+  ok = ::close(fd) == 0 && ok;
+  return ok && std::rename(temporary.c_str(), fileName.c_str()) == 0;
+}
+
+// Reads a checkpoint written by writeCheckpoint(). Non-RT
+inline bool readCheckpoint(const std::string &fileName, ProtocolState &s) {
+  std::ifstream file(fileName.c_str());
+  if (!file.is_open())
+    return false;
+
+  std::map<std::string, double> values;
+  ApdHistory history;
+  history.clear();
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::istringstream row(line);
+    std::string name;
+    double value;
+    if (!(row >> name >> value))
+      return false;
+    if (name == "apd") {
+      int injection;
+      if (!(row >> injection))
+        return false;
+      history.add(value, injection);
+    }
+    else
+      values[name] = value;
+  }
+
+  const char *names[] = {"version", "mode", "beat", "time", "cycle",
+                         "stim_amplitude", "rrc_amplitude", "rrc_injection",
+                         "thresh_amplitude", "thresh_previous_apd",
+                         "thresh_max", "random", "random_injection",
+                         "random_threshold", "pace_end_beat",
+                         "sequence_step", "sequence_transitions",
+                         "sequence_id", "sequence_mode"};
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    if (!values.count(names[i]))
+      return false;
+  if (values["version"] != 2)
+    return false;
+
+  s.mode = values["mode"];
+  s.beatNumber = values["beat"];
+  s.time = values["time"];
+  s.cycle = values["cycle"];
+  s.stimAmplitude = values["stim_amplitude"];
+  s.rrcAmplitude = values["rrc_amplitude"];
+  s.rrcInjectionAmplitude = values["rrc_injection"];
+  s.threshAmplitude = values["thresh_amplitude"];
+  s.threshPreviousApd = values["thresh_previous_apd"];
+  s.threshMaxAmplitude = values["thresh_max"];
+  s.random = values["random"];
+  s.randomInjection = values["random_injection"];
+  s.randomThreshold = values["random_threshold"];
+  s.paceEndBeat = values["pace_end_beat"];
+  s.sequenceStep = values["sequence_step"];
+  s.sequenceTransitions = values["sequence_transitions"];
+  s.sequenceId = values["sequence_id"];
+  s.sequenceMode = values["sequence_mode"];
+  s.history = history;
+  return s.beatNumber > 0 && s.cycle > 0;
+}
+
+// Hands states from the RT thread to a thread that writes the latest one
+class CheckpointWriter {
+ public:
+  CheckpointWriter() :
+      interval(1000), ring(16), running(false), failed(false) {}
+
+  ~CheckpointWriter() {
+    stop(false);
+  }
+
+  // Non-RT, while the RT thread is paused. Starts writer thread,
+  // checkpoints replace fileName
+  void start(const std::string &fileName) {
+    stop(false);
+    this->fileName = fileName;
+    failed = false;
+    ring.clear();
+    running = true;
+    thread = std::thread(&CheckpointWriter::run, this);
+  }
+
+  // Non-RT. Stops writer thread. A protocol that ended removes its
+  // checkpoint, otherwise the latest state is written
+  void stop(bool remove) {
+    if (!thread.joinable())
+      return;
+
+    running = false;
+    thread.join();
+    if (remove)
+      std::remove(fileName.c_str());
+  }
+
+  bool isOpen() const {
+    return running.load(std::memory_order_relaxed);
+  }
+
+  // RT. States are dropped if the writer falls 16 beats behind
+  void push(const ProtocolState &state) {
+    ring.push(state);
+  }
+
+  bool error() const {
+    return failed.load(std::memory_order_relaxed);
+  }
+
+  int interval; // Shortest time between writes (ms)
+
+ private:
+  void run() {
+    ProtocolState latest;
+    bool pending = false;
+    std::chrono::steady_clock::time_point written;
+
+    for (;;) {
+      bool stopping = !running.load(std::memory_order_acquire);
+      while (ring.pop(latest))
+        pending = true;
+
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now();
+      if (pending && (stopping || now - written >=
+                      std::chrono::milliseconds(interval))) {
+        if (!writeCheckpoint(fileName, latest))
+          failed = true;
+        pending = false;
+        written = now;
+      }
+      if (stopping)
+        break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+  }
+
+  std::string fileName;
+  RingBuffer<ProtocolState> ring;
+  std::thread thread;
+  std::atomic<bool> running;
+  std::atomic<bool> failed;
+}; // Class CheckpointWriter
+}; // Namespace RRC
+
+#endif // RRC_CHECKPOINT_H
@@ -0,0 +1,458 @@
+#ifndef RRC_COMPRESSEDTRACE_H
+#define RRC_COMPRESSEDTRACE_H
+
+#include "RRC_Trace.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Compressed trace format for long recordings. Voltage and current are
+// quantized to the amplifier resolution, which is lossless for digitized
+// data, and stored as sample to sample differences. Time is stored exactly,
+// as the difference of its bits from the previous time plus one period, which
+// is 0 except where time jumps (sequence steps, dropped records). Differences
+// are Rice coded in blocks, each with its own coding parameters. A block
+// index at the end of the file lets a beat be decoded without reading the
+// whole file.
+//
+// File layout:
+//   CompressedTraceHeader
+//   Block: CompressedBlockHeader, Rice coded payload
+//   ...
+//   CompressedBlockIndex for every block, starting at header.indexOffset
+namespace RRC {
+struct CompressedTraceHeader {
+  char magic[8]; // "RRCZTRAC"
+  uint32_t version;
+  uint32_t blockSamples; // Maximum number of samples in a block
+  double period; // RTXI thread period (ms)
+  double voltageResolution; // Quantization step of voltage (mV)
+  double currentResolution; // Quantization step of current (A)
+  uint64_t indexOffset; // Offset of block index, 0 if writer did not finish
+  uint64_t blocks; // Number of blocks
+};
+
+struct CompressedBlockHeader {
+  uint64_t firstSample; // Index of first sample in trace
+  double firstTime; // Time of first sample (ms)
+  int64_t firstVoltage; // Quantized voltage of first sample
+  int64_t firstCurrent; // Quantized current of first sample
+  int32_t firstBeat; // Beat number of first sample
+  int32_t lastBeat; // Beat number of last sample
+  int32_t firstMode; // Execute mode of first sample
+  uint32_t samples; // Samples in block
+  uint32_t payloadBytes; // Size of Rice coded payload
+  uint8_t riceK[5]; // Rice parameter of voltage, current, beat, mode and
+                    // time streams
+};
+
+struct CompressedBlockIndex {
+  uint64_t offset; // File offset of block header
+  uint64_t firstSample;
+  int32_t firstBeat;
+  int32_t lastBeat;
+};
+
+static const char compressedTraceMagic[8] =
+    {'R', 'R', 'C', 'Z', 'T', 'R', 'A', 'C'};
+static const uint32_t compressedTraceVersion = 2;
+static const size_t compressedStreams = 5;
+static const size_t compressedBlockSamples = 4096;
+
+// Rice coding of zigzag encoded differences. Quotients of 32 or more are
+// escaped and followed by the raw 64 bit value.
+namespace Rice {
+static const unsigned escape = 32;
+
+inline uint64_t zigzag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+      static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Parameter giving the fewest bits for values
+inline unsigned bestK(const uint64_t *values, size_t n) {
+  unsigned best = 0;
+  uint64_t bestBits = ~0ULL;
+  for (unsigned k = 0; k < escape - 1; k++) {
+    uint64_t bits = 0;
+    for (size_t i = 0; i < n; i++) {
+      uint64_t q = values[i] >> k;
+      bits += q < escape ? q + 1 + k : escape + 64;
+    }
+    if (bits < bestBits) {
+      bestBits = bits;
+      best = k;
+    }
+  }
+  return best;
+}
+
+// Bits are packed most significant first
+class BitWriter {
+ public:
+  explicit BitWriter(uint8_t *data) : data(data), bytes(0), bits(0), fill(0) {}
+
+  // Writes low count bits of value, count is at most 64
+  void put(uint64_t value, unsigned count) {
+    while (count > 0) {
+      unsigned n = count < 8 - fill ? count : 8 - fill;
+      bits = (bits << n) | ((value >> (count - n)) & ((1u << n) - 1));
+      fill += n;
+      count -= n;
+      if (fill == 8) {
+        data[bytes++] = static_cast<uint8_t>(bits);
+        bits = 0;
+        fill = 0;
+      }
+    }
+  }
+
+  void putRice(uint64_t value, unsigned k) {
+    uint64_t q = value >> k;
+    if (q < escape) {
+      // q ones followed by a zero
+      put(((1ULL << q) - 1) << 1, q + 1);
+      put(value, k);
+    }
+    else {
+      put((1ULL << escape) - 1, escape);
+      put(value, 64);
+    }
+  }
+
+  // Pads last byte and returns total bytes written
+  size_t finish() {
+    if (fill > 0)
+      put(0, 8 - fill);
+    return bytes;
+  }
+
+ private:
+  uint8_t *data;
+  size_t bytes;
+  unsigned bits;
+  unsigned fill; // Bits in current byte
+};
+
+class BitReader {
+ public:
+  BitReader(const uint8_t *data, size_t size) :
+      data(data), size(size), position(0) {}
+
+  // Reads count bits, count is at most 64. Reads past the end give zeros
+  uint64_t get(unsigned count) {
+    uint64_t value = 0;
+    while (count > 0) {
+      size_t byte = position >> 3;
+      unsigned offset = position & 7;
+      unsigned n = count < 8 - offset ? count : 8 - offset;
+      unsigned current = byte < size ? data[byte] : 0;
+      value = (value << n) |
+          ((current >> (8 - offset - n)) & ((1u << n) - 1));
+      position += n;
+      count -= n;
+    }
+    return value;
+  }
+
+  uint64_t getRice(unsigned k) {
+    uint64_t q = 0;
+    while (q < escape && get(1))
+      q++;
+    if (q == escape)
+      return get(64);
+    return (q << k) | get(k);
+  }
+
+ private:
+  const uint8_t *data;
+  size_t size;
+  size_t position; // Bit position
+};
+}; // Namespace Rice
+
+// Time is predicted as the previous time plus one period, computed as the
+// module computes it. Differences of the bits from the prediction are exact
+inline uint64_t timeBits(double time) {
+  uint64_t bits;
+  std::memcpy(&bits, &time, sizeof(bits));
+  return bits;
+}
+
+inline double bitsTime(uint64_t bits) {
+  double time;
+  std::memcpy(&time, &bits, sizeof(time));
+  return time;
+}
+
+class CompressedTraceWriter : public TraceSink {
+ public:
+  explicit CompressedTraceWriter(size_t capacity = 1 << 18) :
+      TraceSink(capacity, compressedBlockSamples), voltageResolution(0.01),
+      currentResolution(1e-12), offset(0), samples(0),
+      // Worst case of an escaped value in every stream
+      payload(compressedBlockSamples * compressedStreams *
+              (Rice::escape + 64) / 8 + 8),
+      deltas(compressedStreams,
+             std::vector<uint64_t>(compressedBlockSamples)) {}
+
+  ~CompressedTraceWriter() {
+    close();
+  }
+
+  // Non-RT. Resolutions are the quantization steps of voltage (mV) and
+  // current (A), and must be positive
+  bool open(const std::string &fileName, double period,
+            double voltageResolution, double currentResolution) {
+    if (!(voltageResolution > 0) || !(currentResolution > 0))
+      return false;
+    this->voltageResolution = voltageResolution;
+    this->currentResolution = currentResolution;
+    return TraceSink::open(fileName, period);
+  }
+
+ protected:
+  void begin() {
+    index.clear();
+    samples = 0;
+    offset = sizeof(CompressedTraceHeader);
+    writeHeader(0);
+  }
+
+  void writeBlock(const TraceRecord *records, size_t n) {
+    CompressedBlockHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.firstSample = samples;
+    header.firstTime = records[0].time;
+    header.firstVoltage = quantize(records[0].voltage, voltageResolution);
+    header.firstCurrent = quantize(records[0].current, currentResolution);
+    header.firstBeat = records[0].beatNumber;
+    header.lastBeat = records[n - 1].beatNumber;
+    header.firstMode = records[0].mode;
+    header.samples = n;
+
+    // Differences of each stream, first sample is stored in header
+    int64_t voltage = header.firstVoltage;
+    int64_t current = header.firstCurrent;
+    int32_t beat = header.firstBeat;
+    int32_t mode = header.firstMode;
+    double time = header.firstTime;
+    for (size_t i = 1; i < n; i++) {
+      int64_t v = quantize(records[i].voltage, voltageResolution);
+      int64_t c = quantize(records[i].current, currentResolution);
+      deltas[0][i - 1] = Rice::zigzag(v - voltage);
+      deltas[1][i - 1] = Rice::zigzag(c - current);
+      deltas[2][i - 1] = Rice::zigzag(records[i].beatNumber - beat);
+      deltas[3][i - 1] = Rice::zigzag(records[i].mode - mode);
+      deltas[4][i - 1] = Rice::zigzag(static_cast<int64_t>(
+          timeBits(records[i].time) - timeBits(time + period)));
+      time = records[i].time;
+      voltage = v;
+      current = c;
+      beat = records[i].beatNumber;
+      mode = records[i].mode;
+    }
+
+    Rice::BitWriter bits(&payload[0]);
+    for (size_t s = 0; s < compressedStreams; s++) {
+      header.riceK[s] = Rice::bestK(&deltas[s][0], n - 1);
+      for (size_t i = 0; i + 1 < n; i++)
+        bits.putRice(deltas[s][i], header.riceK[s]);
+    }
+    header.payloadBytes = bits.finish();
+
+    CompressedBlockIndex entry;
+    entry.offset = offset;
+    entry.firstSample = samples;
+    entry.firstBeat = header.firstBeat;
+    entry.lastBeat = header.lastBeat;
+    index.push_back(entry);
+
+    writeAt(&header, sizeof(header), offset);
+    writeAt(&payload[0], header.payloadBytes, offset + sizeof(header));
+    offset += sizeof(header) + header.payloadBytes;
+    samples += n;
+  }
+
+  void finish() {
+    if (!index.empty())
+      writeAt(&index[0], index.size() * sizeof(CompressedBlockIndex), offset);
+    writeHeader(offset);
+  }
+
+ private:
+  static int64_t quantize(double value, double resolution) {
+    return std::llround(value / resolution);
+  }
+
+  void writeHeader(uint64_t indexOffset) {
+    CompressedTraceHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, compressedTraceMagic, sizeof(header.magic));
+    header.version = compressedTraceVersion;
+    header.blockSamples = compressedBlockSamples;
+    header.period = period;
+    header.voltageResolution = voltageResolution;
+    header.currentResolution = currentResolution;
+    header.indexOffset = indexOffset;
+    header.blocks = index.size();
+    writeAt(&header, sizeof(header), 0);
+  }
+
+  double voltageResolution;
+  double currentResolution;
+  uint64_t offset; // File offset of next block
+  uint64_t samples; // Samples written to file
+  std::vector<uint8_t> payload; // Rice coded block, sized for worst case
+  std::vector<std::vector<uint64_t> > deltas; // Differences of each stream
+  std::vector<CompressedBlockIndex> index; // Grows by one entry per block
+}; // Class CompressedTraceWriter
+
+class CompressedTraceReader {
+ public:
+  CompressedTraceReader() : file(NULL) {}
+
+  ~CompressedTraceReader() {
+    close();
+  }
+
+  // Reads header and block index. If the writer did not finish, the index is
+  // rebuilt from the block headers.
+  bool open(const std::string &fileName) {
+    close();
+
+    file = std::fopen(fileName.c_str(), "rb");
+    if (!file)
+      return false;
+    if (std::fread(&header, sizeof(header), 1, file) != 1 ||
+        std::memcmp(header.magic, compressedTraceMagic,
+                    sizeof(compressedTraceMagic)) != 0 ||
+        header.version != compressedTraceVersion) {
+      close();
+      return false;
+    }
+
+    if (header.indexOffset > 0) {
+      index.resize(header.blocks);
+      if (header.blocks > 0 &&
+          (fseeko(file, header.indexOffset, SEEK_SET) != 0 ||
+           std::fread(&index[0], sizeof(CompressedBlockIndex), index.size(),
+                      file) != index.size())) {
+        close();
+        return false;
+      }
+    }
+    else {
+      CompressedBlockHeader block;
+      uint64_t offset = sizeof(header);
+      while (fseeko(file, offset, SEEK_SET) == 0 &&
+             std::fread(&block, sizeof(block), 1, file) == 1) {
+        CompressedBlockIndex entry;
+        entry.offset = offset;
+        entry.firstSample = block.firstSample;
+        entry.firstBeat = block.firstBeat;
+        entry.lastBeat = block.lastBeat;
+        index.push_back(entry);
+        offset += sizeof(block) + block.payloadBytes;
+      }
+    }
+    return true;
+  }
+
+  void close() {
+    if (file)
+      std::fclose(file);
+    file = NULL;
+    index.clear();
+  }
+
+  size_t blocks() const { return index.size(); }
+  double period() const { return header.period; }
+
+  // Decodes one block and appends its records to records
+  bool readBlock(size_t i, std::vector<TraceRecord> &records) {
+    CompressedBlockHeader block;
+    if (i >= index.size() || fseeko(file, index[i].offset, SEEK_SET) != 0 ||
+        std::fread(&block, sizeof(block), 1, file) != 1)
+      return false;
+    payload.resize(block.payloadBytes);
+    if (block.payloadBytes > 0 &&
+        std::fread(&payload[0], 1, payload.size(), file) != payload.size())
+      return false;
+
+    size_t n = block.samples;
+    deltas.resize(compressedStreams * n);
+    Rice::BitReader bits(payload.empty() ? NULL : &payload[0],
+                         payload.size());
+    for (size_t s = 0; s < compressedStreams; s++)
+      for (size_t j = 0; j + 1 < n; j++)
+        deltas[s * n + j] = bits.getRice(block.riceK[s]);
+
+    int64_t voltage = block.firstVoltage;
+    int64_t current = block.firstCurrent;
+    int32_t beat = block.firstBeat;
+    int32_t mode = block.firstMode;
+    double time = block.firstTime;
+    for (size_t j = 0; j < n; j++) {
+      if (j > 0) {
+        voltage += Rice::unzigzag(deltas[j - 1]);
+        current += Rice::unzigzag(deltas[n + j - 1]);
+        beat += Rice::unzigzag(deltas[2 * n + j - 1]);
+        mode += Rice::unzigzag(deltas[3 * n + j - 1]);
+        time = bitsTime(timeBits(time + header.period) +
+                        Rice::unzigzag(deltas[4 * n + j - 1]));
+      }
+      TraceRecord record = {time,
+                            voltage * header.voltageResolution,
+                            current * header.currentResolution, beat, mode};
+      records.push_back(record);
+    }
+    return true;
+  }
+
+  // Decodes only the blocks holding beatNumber and returns its records
+  bool readBeat(int beatNumber, std::vector<TraceRecord> &records) {
+    records.clear();
+    std::vector<TraceRecord> block;
+    for (size_t i = firstBlock(beatNumber);
+         i < index.size() && index[i].firstBeat <= beatNumber; i++) {
+      block.clear();
+      if (!readBlock(i, block))
+        return false;
+      for (size_t j = 0; j < block.size(); j++)
+        if (block[j].beatNumber == beatNumber)
+          records.push_back(block[j]);
+    }
+    return true;
+  }
+
+ private:
+  // First block whose last beat is not before beatNumber
+  size_t firstBlock(int beatNumber) const {
+    size_t low = 0;
+    size_t high = index.size();
+    while (low < high) {
+      size_t middle = (low + high) / 2;
+      if (index[middle].lastBeat < beatNumber)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+    return low;
+  }
+
+  std::FILE *file;
+  CompressedTraceHeader header;
+  std::vector<CompressedBlockIndex> index;
+  std::vector<uint8_t> payload;
+  std::vector<uint64_t> deltas;
+}; // Class CompressedTraceReader
+}; // Namespace RRC
+
+#endif // RRC_COMPRESSEDTRACE_H
@@ -0,0 +1,214 @@
+#ifndef RRC_CONTROL_H
+#define RRC_CONTROL_H
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Local control socket. Clients connect to a Unix domain socket and send one
+// command per line. The server never blocks: poll() is called from the GUI
+// refresh timer, accepts clients, reads whatever arrived and flushes pending
+// replies, so a slow or stuck client cannot stall the module.
+namespace RRC {
+class ControlServer {
+ public:
+  ControlServer() : listenFd(-1) {}
+
+  ~ControlServer() {
+    close();
+  }
+
+  // Replaces a stale socket file left by a previous run, any other file at
+  // path is left alone. Only the owner may connect to the socket
+  bool listen(const std::string &path, std::string &error) {
+    close();
+
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+      error = "Socket path is empty or too long";
+      return false;
+    }
+    std::strcpy(address.sun_path, path.c_str());
+
+    struct stat existing;
+    if (::lstat(path.c_str(), &existing) == 0) {
+      if (!S_ISSOCK(existing.st_mode)) {
+        error = "Path exists and is not a socket";
+        return false;
+      }
+      ::unlink(path.c_str());
+    }
+
+    listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+      error = std::strerror(errno);
+      return false;
+    }
+    // Socket file is created 0600, chmod covers a umask set elsewhere
+    mode_t mask = ::umask(0077);
+    bool bound = ::bind(listenFd, reinterpret_cast<sockaddr *>(&address),
+                        sizeof(address)) == 0;
+    ::umask(mask);
+    if (!bound || ::chmod(path.c_str(), 0600) < 0 ||
+        ::listen(listenFd, 4) < 0) {
+      error = std::strerror(errno);
+      ::close(listenFd);
+      if (bound)
+        ::unlink(path.c_str());
+      listenFd = -1;
+      return false;
+    }
+    setNonBlocking(listenFd);
+    socketPath = path;
+    return true;
+  }
+
+  void close() {
+    for (size_t i = 0; i < clients.size(); i++)
+      ::close(clients[i].fd);
+    clients.clear();
+    if (listenFd >= 0) {
+      ::close(listenFd);
+      ::unlink(socketPath.c_str());
+    }
+    listenFd = -1;
+    socketPath.clear();
+  }
+
+  bool isListening() const { return listenFd >= 0; }
+  const std::string &path() const { return socketPath; }
+
+  // Accepts clients, reads input and flushes replies. Complete lines are
+  // returned by nextCommand()
+  void poll() {
+    if (listenFd < 0)
+      return;
+
+    int fd;
+    while ((fd = ::accept(listenFd, NULL, NULL)) >= 0) {
+      setNonBlocking(fd);
+      clients.push_back(Client(fd));
+    }
+
+    char buffer[4096];
+    for (size_t i = 0; i < clients.size(); i++) {
+      Client &client = clients[i];
+      ssize_t n;
+      while ((n = ::recv(client.fd, buffer, sizeof(buffer), 0)) > 0)
+        client.input.append(buffer, n);
+      if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) ||
+          client.input.size() > maxLine)
+        client.closed = true;
+      flush(client);
+    }
+    removeClosed();
+  }
+
+  // Pops one command line, client identifies where to send the reply
+  bool nextCommand(int &client, std::string &line) {
+    for (size_t i = 0; i < clients.size(); i++) {
+      std::string &input = clients[i].input;
+      size_t end = input.find('\n');
+      if (end == std::string::npos)
+        continue;
+      line = input.substr(0, end);
+      if (!line.empty() && line[line.size() - 1] == '\r')
+        line.erase(line.size() - 1);
+      input.erase(0, end + 1);
+      client = clients[i].fd;
+      return true;
+    }
+    return false;
+  }
+
+  void reply(int client, const std::string &line) {
+    for (size_t i = 0; i < clients.size(); i++)
+      if (clients[i].fd == client)
+        send(clients[i], line);
+  }
+
+  // Client receives every broadcast() line from now on
+  void subscribe(int client, bool enable) {
+    for (size_t i = 0; i < clients.size(); i++)
+      if (clients[i].fd == client)
+        clients[i].subscribed = enable;
+  }
+
+  bool hasSubscribers() const {
+    for (size_t i = 0; i < clients.size(); i++)
+      if (clients[i].subscribed)
+        return true;
+    return false;
+  }
+
+  void broadcast(const std::string &line) {
+    for (size_t i = 0; i < clients.size(); i++)
+      if (clients[i].subscribed)
+        send(clients[i], line);
+  }
+
+ private:
+  struct Client {
+    explicit Client(int fd) : fd(fd), subscribed(false), closed(false) {}
+    int fd;
+    std::string input; // Received, not yet a complete line
+    std::string output; // Not yet accepted by the socket
+    bool subscribed;
+    bool closed;
+  };
+
+  // Longest command line, and most output held for a client that does not
+  // read, before it is disconnected
+  static const size_t maxLine = 65536;
+  static const size_t maxOutput = 1 << 20;
+
+  static void setNonBlocking(int fd) {
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+
+  void send(Client &client, const std::string &line) {
+    client.output += line;
+    client.output += '\n';
+    flush(client);
+  }
+
+  void flush(Client &client) {
+    while (!client.output.empty() && !client.closed) {
+      ssize_t n = ::send(client.fd, client.output.data(),
+                         client.output.size(), MSG_NOSIGNAL);
+      if (n > 0)
+        client.output.erase(0, n);
+      else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        break;
+      else
+        client.closed = true;
+    }
+    if (client.output.size() > maxOutput)
+      client.closed = true;
+  }
+
+  void removeClosed() {
+    for (size_t i = clients.size(); i-- > 0;) {
+      if (clients[i].closed) {
+        ::close(clients[i].fd);
+        clients.erase(clients.begin() + i);
+      }
+    }
+  }
+
+  int listenFd;
+  std::string socketPath;
+  std::vector<Client> clients;
+}; // Class ControlServer
+}; // Namespace RRC
+
+#endif // RRC_CONTROL_H
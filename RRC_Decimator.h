@@ -0,0 +1,50 @@
+#ifndef RRC_DECIMATOR_H
+#define RRC_DECIMATOR_H
+
+// Decimation of the sample stream for analysis at a lower rate than the RTXI
+// loop. Each output sample is the mean of factor input samples, a boxcar
+// anti-aliasing filter, stamped with the mean time of those samples. A boxcar
+// delays the signal by half its window, so the mean time is the exact time
+// of the averaged sample. A factor of 1 passes samples through unchanged.
+namespace RRC {
+class Decimator {
+ public:
+  Decimator() : factor(1), time(0), voltage(0) {
+    reset();
+  }
+
+  // RT. Drops a partially filled window, the next sample starts a new one
+  void reset() {
+    count = 0;
+    sumTime = 0;
+    sumVoltage = 0;
+  }
+
+  // RT. Returns true when a decimated sample is ready in time and voltage
+  bool push(double t, double v) {
+    sumTime += t;
+    sumVoltage += v;
+    if (++count < factor)
+      return false;
+
+    time = sumTime / count;
+    voltage = sumVoltage / count;
+    reset();
+    return true;
+  }
+
+  // Settings
+  int factor; // Input samples per output sample
+
+  // Last decimated sample
+  double time; // Mean time of averaged samples (ms)
+  double voltage; // Mean voltage of averaged samples (mV)
+
+ private:
+  int count; // Samples in current window
+  double sumTime;
+  double sumVoltage;
+}; // Class Decimator
+}; // Namespace RRC
+
+#endif // RRC_DECIMATOR_H
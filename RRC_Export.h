@@ -0,0 +1,255 @@
+#ifndef RRC_EXPORT_H
+#define RRC_EXPORT_H
+
+#include "RRC_Trace.h"
+#include "RRC_Features.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+
+// Live export of the sample stream and analyzed beats through POSIX shared
+// memory, /dev/shm/<name> on Linux. The object is a 4096 byte ExportHeader,
+// a ring of sampleCapacity TraceRecords at sampleOffset and a ring of
+// beatCapacity BeatRecords at beatOffset. Entry i of a stream is stored at
+// index i % capacity.
+//
+// There is a single writer per ring. It stores an entry and then advances the
+// ring's 64-bit counter with release ordering. A reader loads the counter,
+// copies entries it has not seen and loads the counter again. Entries older
+// than the second counter minus capacity may have been overwritten while
+// being copied and must be discarded. All fields are native endian.
+namespace RRC {
+struct ExportHeader {
+  char magic[8]; // "RRCLIVE"
+  uint32_t version;
+  uint32_t sampleSize; // sizeof(TraceRecord)
+  uint32_t beatSize; // sizeof(BeatRecord)
+  uint32_t reserved;
+  uint64_t sampleOffset; // Offset of sample ring from start of object
+  uint64_t sampleCapacity;
+  uint64_t beatOffset; // Offset of beat ring from start of object
+  uint64_t beatCapacity;
+  double period; // RTXI thread period (ms)
+  std::atomic<uint64_t> samplesWritten; // Samples published since creation
+  std::atomic<uint64_t> beatsWritten; // Beats published since creation
+};
+
+static const char exportMagic[8] = {'R', 'R', 'C', 'L', 'I', 'V', 'E', 0};
+static const uint32_t exportVersion = 1;
+static const size_t exportHeaderSize = 4096;
+
+class SharedExport {
+ public:
+  SharedExport() : header(NULL), samples(NULL), beats(NULL), size(0) {}
+
+  ~SharedExport() {
+    close();
+  }
+
+  // Non-RT. Creates the object and touches every page, so that publishing
+  // from the RT thread never faults
+  bool open(const std::string &name, size_t sampleCapacity,
+            size_t beatCapacity, double period) {
+    close();
+
+    size_t beatOffset = exportHeaderSize +
+        roundUp(sampleCapacity * sizeof(TraceRecord));
+    size_t total = beatOffset + roundUp(beatCapacity * sizeof(BeatRecord));
+    std::string path = "/" + name;
+    int fd = ::shm_open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0)
+      return false;
+    if (::ftruncate(fd, total) < 0) {
+      ::close(fd);
+      ::shm_unlink(path.c_str());
+      return false;
+    }
+    void *memory = ::mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+      ::shm_unlink(path.c_str());
+      return false;
+    }
+    std::memset(memory, 0, total);
+    ::mlock(memory, total); // Best effort, limited by RLIMIT_MEMLOCK
+
+    header = new (memory) ExportHeader;
+    std::memcpy(header->magic, exportMagic, sizeof(exportMagic));
+    header->version = exportVersion;
+    header->sampleSize = sizeof(TraceRecord);
+    header->beatSize = sizeof(BeatRecord);
+    header->sampleOffset = exportHeaderSize;
+    header->sampleCapacity = sampleCapacity;
+    header->beatOffset = beatOffset;
+    header->beatCapacity = beatCapacity;
+    header->period = period;
+    header->samplesWritten.store(0, std::memory_order_relaxed);
+    header->beatsWritten.store(0, std::memory_order_release);
+    samples = reinterpret_cast<TraceRecord *>(
+        static_cast<char *>(memory) + exportHeaderSize);
+    beats = reinterpret_cast<BeatRecord *>(
+        static_cast<char *>(memory) + beatOffset);
+    size = total;
+    objectName = path;
+    return true;
+  }
+
+  // Non-RT. Removes the object, readers keep their mapping until they unmap
+  void close() {
+    if (!header)
+      return;
+    ::munmap(header, size);
+    ::shm_unlink(objectName.c_str());
+    header = NULL;
+    samples = NULL;
+    beats = NULL;
+    size = 0;
+  }
+
+  bool isOpen() const { return header != NULL; }
+
+  // Non-RT, while the RT thread is inactive
+  void setPeriod(double period) {
+    if (header)
+      header->period = period;
+  }
+
+  // RT. Only the RT thread publishes samples
+  void pushSample(const TraceRecord &record) {
+    uint64_t n = header->samplesWritten.load(std::memory_order_relaxed);
+    samples[n % header->sampleCapacity] = record;
+    header->samplesWritten.store(n + 1, std::memory_order_release);
+  }
+
+  // Non-RT. Only the GUI thread publishes beats
+  void pushBeat(const BeatRecord &beat) {
+    uint64_t n = header->beatsWritten.load(std::memory_order_relaxed);
+    beats[n % header->beatCapacity] = beat;
+    header->beatsWritten.store(n + 1, std::memory_order_release);
+  }
+
+ private:
+  static size_t roundUp(size_t bytes) {
+    return (bytes + exportHeaderSize - 1) / exportHeaderSize *
+        exportHeaderSize;
+  }
+
+  ExportHeader *header;
+  TraceRecord *samples;
+  BeatRecord *beats;
+  size_t size;
+  std::string objectName;
+}; // Class SharedExport
+
+// Reader of a live export, for analysis processes on the same machine
+class SharedExportReader {
+ public:
+  SharedExportReader() : header(NULL), size(0), nextSample(0), nextBeat(0) {}
+
+  ~SharedExportReader() {
+    close();
+  }
+
+  // Starts with the oldest sample and beat still in the rings
+  bool open(const std::string &name) {
+    close();
+
+    int fd = ::shm_open(("/" + name).c_str(), O_RDONLY, 0);
+    if (fd < 0)
+      return false;
+    struct stat status;
+    void *memory = MAP_FAILED;
+    if (::fstat(fd, &status) == 0 &&
+        static_cast<size_t>(status.st_size) >= exportHeaderSize)
+      memory = ::mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED)
+      return false;
+
+    header = static_cast<const ExportHeader *>(memory);
+    size = status.st_size;
+    if (std::memcmp(header->magic, exportMagic, sizeof(exportMagic)) != 0 ||
+        header->version != exportVersion ||
+        header->sampleSize != sizeof(TraceRecord) ||
+        header->beatSize != sizeof(BeatRecord)) {
+      close();
+      return false;
+    }
+    nextSample = 0;
+    nextBeat = 0;
+    return true;
+  }
+
+  void close() {
+    if (header)
+      ::munmap(const_cast<ExportHeader *>(header), size);
+    header = NULL;
+    size = 0;
+  }
+
+  double period() const { return header->period; }
+
+  // Copies up to count new samples, returns the number copied. lost is set
+  // to samples overwritten before they could be read
+  size_t readSamples(TraceRecord *out, size_t count, uint64_t &lost) {
+    return read(header->samplesWritten, header->sampleOffset,
+                header->sampleCapacity, nextSample, out, count, lost);
+  }
+
+  size_t readBeats(BeatRecord *out, size_t count, uint64_t &lost) {
+    return read(header->beatsWritten, header->beatOffset,
+                header->beatCapacity, nextBeat, out, count, lost);
+  }
+
+ private:
+  template <typename T>
+  size_t read(const std::atomic<uint64_t> &written, uint64_t offset,
+              uint64_t capacity, uint64_t &next, T *out, size_t count,
+              uint64_t &lost) {
+    const T *ring = reinterpret_cast<const T *>(
+        reinterpret_cast<const char *>(header) + offset);
+    uint64_t end = written.load(std::memory_order_acquire);
+    lost = 0;
+    if (end < next) // Writer was restarted
+      next = 0;
+    if (end - next > capacity) {
+      lost = end - capacity - next;
+      next = end - capacity;
+    }
+    uint64_t first = next;
+    size_t n = end - first < count ? end - first : count;
+    for (size_t i = 0; i < n; i++)
+      out[i] = ring[(first + i) % capacity];
+
+    // Drop copies the writer may have overwritten meanwhile
+    uint64_t after = written.load(std::memory_order_acquire);
+    size_t skip = 0;
+    if (after > capacity && after - capacity > first)
+      skip = after - capacity - first < n ? after - capacity - first : n;
+    if (skip > 0) {
+      std::memmove(out, out + skip, (n - skip) * sizeof(T));
+      n -= skip;
+      lost += skip;
+    }
+    next = first + skip + n;
+    return n;
+  }
+
+  const ExportHeader *header;
+  size_t size;
+  uint64_t nextSample;
+  uint64_t nextBeat;
+}; // Class SharedExportReader
+}; // Namespace RRC
+
+#endif // RRC_EXPORT_H
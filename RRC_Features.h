@@ -0,0 +1,330 @@
+#ifndef RRC_FEATURES_H
+#define RRC_FEATURES_H
+
+#include "RRC_RingBuffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Per-beat action potential morphology. Beat waveforms are captured by the RT
+// thread into preallocated slots and analyzed by a worker thread, so the only
+// work added to a tick is storing the voltage.
+namespace RRC {
+struct BeatFeatures {
+  double restingVoltage; // Vm at stimulus (mV)
+  double restingDrift; // Change of resting Vm from previous beat (mV)
+  double maxDvdt; // Maximum rate of depolarization (mV/ms)
+  double upstrokeVelocity; // Mean dV/dt from 10% to 90% of amplitude (mV/ms)
+  double peakVoltage; // Overshoot (mV)
+  double plateauVoltage; // Mean Vm from 20% to 50% of APD90 (mV)
+  double apd30; // APD at 30% repolarization (ms)
+  double apd90; // APD at 90% repolarization (ms)
+  double triangulation; // APD90 - APD30 (ms)
+};
+
+// Computes features of one beat sampled every period (ms) from stimulus onset.
+// APDs are measured from the time of maximum dV/dt and are 0 if the cell did
+// not repolarize past that level before the next stimulus.
+inline void computeBeatFeatures(const double *v, size_t n, double period,
+                                BeatFeatures &features) {
+  features = BeatFeatures();
+  if (n < 2)
+    return;
+
+  // Pass 1: peak voltage and maximum slope, written as plain reductions so
+  // the compiler can vectorize them
+  double peak = v[0];
+  double maxDiff = v[1] - v[0];
+  for (size_t i = 1; i < n; i++) {
+    double diff = v[i] - v[i - 1];
+    peak = v[i] > peak ? v[i] : peak;
+    maxDiff = diff > maxDiff ? diff : maxDiff;
+  }
+
+  // Pass 2: locate peak and upstroke. A NaN sample can make a reduction NaN,
+  // which no sample equals, so the searches stop at the end of the beat
+  size_t peakIndex = 0;
+  while (peakIndex < n && v[peakIndex] != peak)
+    peakIndex++;
+  size_t upstrokeIndex = 1;
+  while (upstrokeIndex < n &&
+         v[upstrokeIndex] - v[upstrokeIndex - 1] != maxDiff)
+    upstrokeIndex++;
+  if (peakIndex == n || upstrokeIndex == n)
+    return;
+
+  double rest = v[0];
+  double amplitude = peak - rest;
+  features.restingVoltage = rest;
+  features.peakVoltage = peak;
+  features.maxDvdt = maxDiff / period;
+  if (amplitude <= 0)
+    return;
+
+  // Upstroke velocity between 10% and 90% of amplitude
+  size_t up10 = 0;
+  while (up10 < peakIndex && v[up10] < rest + 0.1 * amplitude)
+    up10++;
+  size_t up90 = up10;
+  while (up90 < peakIndex && v[up90] < rest + 0.9 * amplitude)
+    up90++;
+  features.upstrokeVelocity = up90 > up10 ?
+      0.8 * amplitude / ((up90 - up10) * period) : features.maxDvdt;
+
+  // Repolarization levels after peak
+  size_t repol30 = peakIndex;
+  while (repol30 < n && v[repol30] > peak - 0.3 * amplitude)
+    repol30++;
+  size_t repol90 = repol30;
+  while (repol90 < n && v[repol90] > peak - 0.9 * amplitude)
+    repol90++;
+  if (repol30 < n)
+    features.apd30 = (static_cast<double>(repol30) - upstrokeIndex) * period;
+  if (repol90 < n)
+    features.apd90 = (static_cast<double>(repol90) - upstrokeIndex) * period;
+  if (repol30 < n && repol90 < n)
+    features.triangulation = features.apd90 - features.apd30;
+
+  // Plateau from 20% to 50% of APD90
+  if (features.apd90 > 0) {
+    size_t first = upstrokeIndex +
+        static_cast<size_t>(0.2 * (repol90 - upstrokeIndex));
+    size_t last = upstrokeIndex +
+        static_cast<size_t>(0.5 * (repol90 - upstrokeIndex));
+    double sum = 0;
+    for (size_t i = first; i < last; i++)
+      sum += v[i];
+    features.plateauVoltage = last > first ? sum / (last - first) : v[first];
+  }
+}
+
+// Beat handed from the RT thread to the worker and on to the GUI
+struct BeatRecord {
+  enum injection_t {NONE, SUB, SUPRA, TEST}; // RRC injection of beat
+
+  int32_t beatNumber;
+  int32_t injection;
+  double startTime; // Time of stimulus (ms)
+  double apd; // APD found by online detector during beat, -1 if none (ms)
+  uint32_t slot; // Waveform slot, only valid while being analyzed
+  uint32_t samples; // Samples captured
+  BeatFeatures features; // Filled by worker
+};
+
+// Last beats kept for overlay display. Storage is allocated once, filled by
+// the analyzer worker and copied out by the GUI, so it is shared between
+// non-RT threads only and guarded by a mutex.
+class BeatOverlay {
+ public:
+  BeatOverlay() : capacity(0), next(0), changed(false) {}
+
+  // Keeps up to beats waveforms of up to samplesPerBeat samples each
+  void allocate(size_t beats, size_t samplesPerBeat) {
+    std::lock_guard<std::mutex> lock(mutex);
+    capacity = samplesPerBeat;
+    records.assign(beats, BeatRecord());
+    storage.assign(beats * capacity, 0);
+    next = 0;
+    changed = true;
+  }
+
+  // Waveform starts at stimulus onset, so stored beats are aligned
+  void add(const BeatRecord &beat, const double *samples) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (records.empty())
+      return;
+    size_t i = next % records.size();
+    records[i] = beat;
+    std::copy(samples, samples + beat.samples, &storage[i * capacity]);
+    next++;
+    changed = true;
+  }
+
+  // Copies kept beats oldest first, the waveform of beat i starting at
+  // samples[i * samplesPerBeat]. Returns false if nothing changed since the
+  // previous copy, in which case beats and samples are left untouched
+  bool copy(std::vector<BeatRecord> &beats, std::vector<double> &samples,
+            size_t &samplesPerBeat) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!changed)
+      return false;
+    changed = false;
+
+    size_t count = next < records.size() ? next : records.size();
+    beats.resize(count);
+    samples.resize(count * capacity);
+    samplesPerBeat = capacity;
+    for (size_t j = 0; j < count; j++) {
+      size_t i = (next - count + j) % records.size();
+      beats[j] = records[i];
+      std::copy(&storage[i * capacity],
+                &storage[i * capacity] + records[i].samples,
+                &samples[j * capacity]);
+    }
+    return true;
+  }
+
+ private:
+  std::mutex mutex;
+  std::vector<BeatRecord> records;
+  std::vector<double> storage;
+  size_t capacity; // Samples per beat
+  size_t next; // Beats added since allocation
+  bool changed;
+}; // Class BeatOverlay
+
+class BeatAnalyzer {
+ public:
+  // Slot count bounds how far the worker may fall behind the RT thread
+  explicit BeatAnalyzer(size_t beats = 8, size_t results = 64) :
+      slotCount(beats), pending(beats), freeSlots(beats), finished(results),
+      capacity(0), period(0), current(NULL), fill(0), capturing(false),
+      droppedBeats(0), submitted(0), completed(0), running(false),
+      lastRest(NAN) {}
+
+  ~BeatAnalyzer() {
+    stop();
+  }
+
+  // Non-RT, while the RT thread is inactive. Sizes slots for beats of up to
+  // samplesPerBeat ticks, keeps the last overlayBeats for display and
+  // restarts worker
+  void allocate(size_t samplesPerBeat, double period, size_t overlayBeats) {
+    stop();
+
+    capacity = samplesPerBeat;
+    overlayPool.allocate(overlayBeats, samplesPerBeat);
+    this->period = period;
+    storage.assign(slotCount * capacity, 0);
+    pending.clear();
+    freeSlots.clear();
+    finished.clear();
+    for (uint32_t i = 0; i < slotCount; i++)
+      freeSlots.push(i);
+    capturing = false;
+    droppedBeats = 0;
+    submitted = 0;
+    completed = 0;
+    lastRest = NAN;
+
+    running = true;
+    worker = std::thread(&BeatAnalyzer::run, this);
+  }
+
+  void stop() {
+    if (!worker.joinable())
+      return;
+    running = false;
+    worker.join();
+  }
+
+  // RT. Starts capturing a beat into a free slot, if there is one
+  void beginBeat(int beatNumber, double time, int injection) {
+    capturing = freeSlots.pop(record.slot);
+    if (!capturing) {
+      droppedBeats.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    record.beatNumber = beatNumber;
+    record.startTime = time;
+    record.injection = injection;
+    current = &storage[record.slot * capacity];
+    fill = 0;
+  }
+
+  // RT. Called every tick of the beat
+  void sample(double voltage) {
+    if (capturing && fill < capacity)
+      current[fill++] = voltage;
+  }
+
+  // RT. Hands captured beat to worker
+  void endBeat(double apd) {
+    if (!capturing)
+      return;
+    record.apd = apd;
+    record.samples = fill;
+    pending.push(record); // Cannot fail, there are as many entries as slots
+    submitted.store(submitted.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+    capturing = false;
+  }
+
+  // Non-RT. Waits until every handed over beat has been analyzed
+  void wait() {
+    while (worker.joinable() &&
+           completed.load(std::memory_order_acquire) <
+           submitted.load(std::memory_order_acquire))
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // Non-RT. Returns analyzed beats in order
+  bool result(BeatRecord &beat) {
+    return finished.pop(beat);
+  }
+
+  // Non-RT. Last analyzed beats
+  BeatOverlay &overlay() {
+    return overlayPool;
+  }
+
+  // Beats not analyzed because the worker fell behind
+  unsigned long dropped() const {
+    return droppedBeats.load(std::memory_order_relaxed);
+  }
+
+ private:
+  void run() {
+    BeatRecord beat;
+    while (running.load(std::memory_order_acquire)) {
+      if (!pending.pop(beat)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        continue;
+      }
+
+      computeBeatFeatures(&storage[beat.slot * capacity], beat.samples,
+                          period, beat.features);
+      beat.features.restingDrift = std::isnan(lastRest) ?
+          0 : beat.features.restingVoltage - lastRest;
+      lastRest = beat.features.restingVoltage;
+      overlayPool.add(beat, &storage[beat.slot * capacity]);
+
+      freeSlots.push(beat.slot);
+      if (!finished.push(beat))
+        droppedBeats.fetch_add(1, std::memory_order_relaxed);
+      completed.fetch_add(1, std::memory_order_release);
+    }
+  }
+
+  uint32_t slotCount; // Waveform slots, slots is a Qt macro
+  RingBuffer<BeatRecord> pending; // RT to worker
+  RingBuffer<uint32_t> freeSlots; // Worker to RT
+  RingBuffer<BeatRecord> finished; // Worker to GUI
+  std::vector<double> storage; // Waveform slots, capacity samples each
+  size_t capacity;
+  double period;
+
+  // RT capture state
+  BeatRecord record;
+  double *current;
+  size_t fill;
+  bool capturing;
+  std::atomic<unsigned long> droppedBeats;
+  std::atomic<unsigned long> submitted; // Beats handed to worker
+  std::atomic<unsigned long> completed; // Beats analyzed by worker
+
+  // Worker state
+  BeatOverlay overlayPool;
+  std::thread worker;
+  std::atomic<bool> running;
+  double lastRest;
+}; // Class BeatAnalyzer
+}; // Namespace RRC
+
+#endif // RRC_FEATURES_H
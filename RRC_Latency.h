@@ -0,0 +1,124 @@
+#ifndef RRC_LATENCY_H
+#define RRC_LATENCY_H
+
+#include <algorithm>
+#include <cmath>
+
+// Measures the response latency of the cell in ticks. Current pulses are
+// applied after a quiet baseline. The latency of a pulse is the number of
+// ticks from the tick that sets the output to the first input sample that
+// leaves the baseline noise band. It is the I/O delay of the RTXI loop plus
+// the time the membrane takes to charge past the noise band, so it is longer
+// for smaller pulses, a larger Rm * Cm or more noise. It bounds the I/O
+// delay from above and is not the I/O delay itself.
+namespace RRC {
+class LatencyProbe {
+ public:
+  static const int maxPulses = 16;
+
+  LatencyProbe() :
+      pulses(5), baselineTime(20), pulseTime(20), restTime(100),
+      minDeviation(0.2) {
+    start(0.1);
+  }
+
+  // Non-RT or RT, period in ms
+  void start(double period) {
+    baselineTicks = std::max(1, static_cast<int>(baselineTime / period));
+    pulseTicks = std::max(1, static_cast<int>(pulseTime / period));
+    restTicks = std::max(1, static_cast<int>(restTime / period));
+    phase = BASELINE;
+    tick = 0;
+    pulse = 0;
+    detected = 0;
+    sum = 0;
+    sumSquares = 0;
+  }
+
+  // RT. Called every tick with the input of the tick, returns true while the
+  // output pulse should be on
+  bool step(double voltage) {
+    switch (phase) {
+      case BASELINE:
+        sum += voltage;
+        sumSquares += voltage * voltage;
+        if (++tick >= baselineTicks) {
+          mean = sum / tick;
+          double sd = std::sqrt(std::max(0.0, sumSquares / tick -
+                                         mean * mean));
+          threshold = std::max(6 * sd, minDeviation);
+          phase = PULSE;
+          tick = 0;
+          return true; // Output of first pulse tick is set here
+        }
+        return false;
+
+      case PULSE:
+        tick++;
+        if (std::fabs(voltage - mean) > threshold) {
+          latencies[detected++] = tick;
+          phase = REST;
+          tick = 0;
+          return false;
+        }
+        if (tick >= pulseTicks) { // No response, pulse is not counted
+          phase = REST;
+          tick = 0;
+          return false;
+        }
+        return true;
+
+      case REST: // Lets the membrane recover before the next baseline
+        if (++tick >= restTicks) {
+          tick = 0;
+          sum = 0;
+          sumSquares = 0;
+          int count = pulses < maxPulses ? pulses : maxPulses;
+          phase = ++pulse < count ? BASELINE : DONE;
+        }
+        return false;
+
+      default: // DONE
+        return false;
+    }
+  }
+
+  bool done() const { return phase == DONE; }
+
+  // True if at least one pulse produced a response
+  bool valid() const { return done() && detected > 0; }
+
+  // Median latency of the responding pulses (ticks)
+  int ticks() const {
+    if (detected == 0)
+      return 0;
+    int sorted[maxPulses];
+    std::copy(latencies, latencies + detected, sorted);
+    std::sort(sorted, sorted + detected);
+    return sorted[detected / 2];
+  }
+
+  // Settings
+  int pulses; // Pulses applied, at most maxPulses
+  double baselineTime; // Quiet time before each pulse (ms)
+  double pulseTime; // Longest pulse, ended early by a response (ms)
+  double restTime; // Time after each pulse (ms)
+  double minDeviation; // Smallest deviation from baseline counted (mV)
+
+ private:
+  enum phase_t {BASELINE, PULSE, REST, DONE} phase;
+  int baselineTicks;
+  int pulseTicks;
+  int restTicks;
+  int tick; // Ticks in current phase
+  int pulse; // Pulses applied
+  int detected; // Pulses with a response
+  int latencies[maxPulses];
+  double sum; // Baseline voltage sums
+  double sumSquares;
+  double mean;
+  double threshold;
+}; // Class LatencyProbe
+}; // Namespace RRC
+
+#endif // RRC_LATENCY_H
@@ -0,0 +1,322 @@
+#ifndef RRC_MODES_H
+#define RRC_MODES_H
+
+#include "RRC_APD.h"
+
+// Protocol modes run by execute(). Each mode is a type with a static tick()
+// that runs one RTXI period. The module keeps a plain function pointer to the
+// tick of its current mode, set when the mode starts, so a tick is one
+// indirect call through that pointer into code specialized for that mode.
+// There is no switch on the mode and no virtual call.
+//
+// Paced modes derive from PacedMode, the pacing core that advances time and
+// beats, stimulates and runs APD detection and beat capture. It calls the
+// mode's static hooks, which are inlined:
+//   bool recordData(host)         Data recorder starts with protocol
+//   bool done(host, success)      Called when a beat ends, true ends protocol
+//   void finish(host, success)    Clears the mode's state when it ends
+//   void beginBeat(host)          Called at each stimulus (optional)
+//   void inject(host, tick)       Adds current to stimulus (A) (optional)
+//
+// Modes are templates on the host, so they have no RTXI dependency and can be
+// benchmarked against a stand-in host (tools/rrc_dispatch_bench.cpp).
+namespace RRC {
+template <typename Mode>
+struct PacedMode {
+  template <typename Host>
+  static void tick(Host &m) {
+    m.time += m.period;
+    m.time_int += 1;
+
+    if (m.time_int == 0 && Mode::recordData(m) && !m.recording)
+      m.dataRecord_start();
+
+    // If time is greater than BCL, advance the beat
+    if (m.time_int - m.bcl_startTime >= m.bcl_int) {
+      bool success = true;
+      if (Mode::done(m, success)) { // End of protocol
+        m.beat_analyzer.endBeat(m.beat_apd);
+        Mode::finish(m, success);
+        m.output(0) = 0;
+
+        if (m.recording)
+          m.dataRecord_stop();
+        m.protocolDone(success);
+        return;
+      }
+
+      m.beatNumber++;
+      m.beatNumber_int++;
+      m.bcl_startTime = m.time_int;
+      // First step is APD calculate called at each stimulus
+      m.calculateAPD(1);
+      Mode::beginBeat(m);
+    }
+
+    int beatTick = m.time_int - m.bcl_startTime;
+    m.outputCurrent = 0;
+    // Stimulate cell for denoted stimulation length
+    if (beatTick < m.stim_length_int) {
+      // Stimulus current (A), precomputed from amplitude and its units
+      m.outputCurrent += m.stim_current;
+    }
+    Mode::inject(m, beatTick);
+    // Add modeled current of dynamic clamp, nA converted to A
+    m.outputCurrent += m.calculateDynamicClamp() * 1e-9;
+    // Set module output
+    m.output(0) = m.outputCurrent;
+
+    // Calculate APD
+    m.calculateAPD(2); // Second step of APD calculation
+    m.captureBeat();
+  }
+
+  // Default hooks
+  template <typename Host>
+  static void beginBeat(Host &) {}
+
+  template <typename Host>
+  static void inject(Host &, int) {}
+
+  // Adds RRC waveform during the injection window of a beat
+  template <typename Host>
+  static void injectRRC(Host &m, int beatTick) {
+    if (beatTick > m.rrc_startTime && beatTick < m.rrc_endTime)
+      m.outputCurrent += m.rrc_injectionAmplitude *
+          m.rrc_waveform[beatTick - m.rrc_startTime - 1];
+  }
+}; // Struct PacedMode
+
+struct IdleMode {
+  template <typename Host>
+  static void tick(Host &) {}
+}; // Struct IdleMode
+
+// Static pacing, a sequence step ends after its beats and succeeds if the
+// last beat was an AP
+struct PaceMode : PacedMode<PaceMode> {
+  template <typename Host>
+  static bool recordData(const Host &m) { return m.pace_recordData; }
+
+  template <typename Host>
+  static bool done(Host &m, bool &success) {
+    success = m.beat_apd > 0;
+    return m.pace_endBeat > 0 && m.beatNumber >= m.pace_endBeat;
+  }
+
+  template <typename Host>
+  static void finish(Host &m, bool) { m.pace_onFlag = false; }
+}; // Struct PaceMode
+
+// Repolarization reserve current threshold search
+struct RRCThresholdMode : PacedMode<RRCThresholdMode> {
+  template <typename Host>
+  static bool recordData(const Host &m) { return m.thresh_recordData; }
+
+  template <typename Host>
+  static bool done(Host &m, bool &success) {
+    // Compare APDs between previous RRC injection to see if it passes
+    // APD cutoff, if so, end threshold test
+    if (m.beatNumber_int % m.thresh_beatNumber == 0) {
+      if (m.thresh_previousAPD < 0) // Less than 0 before first RRC injection
+        m.thresh_previousAPD = m.apd;
+      // If cell has not repolarized prior to stim, end search
+      else if (m.apd_detector.mode == APDDetector::DOWN)
+        m.thresh_rrcThreshFound = true;
+      // Check if RRC injection APD passes cutoff based on previous APD
+      else if (m.apd >=
+               m.thresh_previousAPD * (1 + (m.thresh_apdCutoff / 100.0)))
+        m.thresh_rrcThreshFound = true;
+      else { // Continue search, increase RRC amplitude
+        m.thresh_previousAPD = m.apd;
+        m.thresh_rrcAmplitude += m.thresh_ampIncrement;
+      }
+    }
+
+    // Search fails once amplitude passes limit of sequence step
+    bool threshFailed = m.thresh_maxAmplitude > 0 &&
+        m.thresh_rrcAmplitude > m.thresh_maxAmplitude;
+    success = m.thresh_rrcThreshFound;
+    return m.thresh_rrcThreshFound || threshFailed;
+  }
+
+  template <typename Host>
+  static void finish(Host &m, bool success) {
+    m.thresh_onFlag = false;
+    // Threshold becomes amplitude of RRC protocol
+    if (success)
+      m.rrc_amplitude = m.thresh_rrcAmplitude;
+  }
+
+  template <typename Host>
+  static void beginBeat(Host &m) {
+    // Injection amplitude for this beat, converted to A
+    m.rrc_injectionAmplitude = m.thresh_rrcAmplitude * m.amplitude_scale;
+  }
+
+  // Perform RRC injection every thresh_beatNumber beats
+  template <typename Host>
+  static void inject(Host &m, int beatTick) {
+    if (m.beatNumber_int % m.thresh_beatNumber == 0)
+      injectRRC(m, beatTick);
+  }
+}; // Struct RRCThresholdMode
+
+// Random repolarization reserve current injection
+struct RRCProtocolMode : PacedMode<RRCProtocolMode> {
+  template <typename Host>
+  static bool recordData(const Host &m) { return m.rrcProtocol_recordData; }
+
+  template <typename Host>
+  static bool done(Host &m, bool &) {
+    return m.beatNumber >= m.rrc_endBeatNumber;
+  }
+
+  template <typename Host>
+  static void finish(Host &m, bool) { m.rrcProtocol_onFlag = false; }
+
+  template <typename Host>
+  static void beginBeat(Host &m) {
+    // Used to determine whether RRC injection will be performed
+    // Random number between 1 and 100, from a generator saved in checkpoints
+    m.rrc_random_injection = m.rrc_random.next() % 100 + 1;
+    // Used to determine if injection is sub- or supra- threshold
+    m.rrc_random_threshold = m.rrc_random.next() % 100 + 1;
+    // Injection amplitude for this beat, converted to A
+    if (m.rrc_random_threshold >= 50)
+      m.rrc_injectionAmplitude = m.rrc_amplitude *
+          (1 + (m.rrc_thresholdWindow / 100.0)) * m.amplitude_scale;
+    else
+      m.rrc_injectionAmplitude = m.rrc_amplitude *
+          (1 - (m.rrc_thresholdWindow / 100.0)) * m.amplitude_scale;
+  }
+
+  // Perform RRC injection every rrc_beatNumber beats and if random number is
+  // greater than rrc_chance
+  template <typename Host>
+  static void inject(Host &m, int beatTick) {
+    if (m.beatNumber_int % m.rrc_beatNumber == 0 &&
+        m.rrc_random_injection <= m.rrc_chance)
+      injectRRC(m, beatTick);
+  }
+}; // Struct RRCProtocolMode
+
+// S1-S2 and dynamic restitution, pacing with BCL set by each step
+struct RestitutionMode : PacedMode<RestitutionMode> {
+  template <typename Host>
+  static bool recordData(const Host &m) { return m.rest_recordData; }
+
+  template <typename Host>
+  static bool done(Host &m, bool &) { return !m.restitutionBeat(); }
+
+  template <typename Host>
+  static void finish(Host &m, bool) { m.rest_onFlag = false; }
+}; // Struct RestitutionMode
+
+// Stimulus threshold search, stimulus increases until it produces an AP
+struct StimThresholdMode {
+  template <typename Host>
+  static void tick(Host &m) {
+    m.time += m.period;
+    m.time_int += 1;
+
+    if (m.time_int == 0 && m.stim_recordData && !m.recording)
+      m.dataRecord_start();
+
+    // Apply stimulus for given number of ms (StimLength)
+    if (m.time_int - m.bcl_startTime < m.stim_length_int) {
+      m.stim_backToBaseline = false;
+
+      // stimulsLevel is in nA, convert to A for amplifier
+      m.output(0) = m.stim_stimulusLevel * 1e-9;
+      return;
+    }
+
+    m.output(0) = 0;
+
+    // Find peak voltage after stimulus
+    if (m.voltage > m.stim_peakVoltage)
+      m.stim_peakVoltage = m.voltage;
+
+    // If Vm is back to resting membrane potential (within 2 mV; determined
+    // when threshold detection button is first pressed)
+    // Vrest: voltage at the time threshold test starts
+    if (m.voltage - m.stim_vmRest >= 2)
+      return;
+
+    if (!m.stim_backToBaseline) {
+      m.stim_responseDuration = m.time - m.stim_startTime;
+      m.stim_responseTime = m.time;
+      m.stim_backToBaseline = true;
+    }
+
+    // Calculate time length of voltage response
+    // If the response was more than 50ms long and peakVoltage is more than
+    // 10mV, consider it an action potential
+    if (m.stim_responseDuration > 50 && m.stim_peakVoltage > 10) {
+      // Set the current stimulus value as 1.25x calculated threshold,
+      // search is in nA, amplitude is kept in its units
+      m.stim_current = m.stim_stimulusLevel * 1.25 * 1e-9;
+      m.stim_amplitude = m.stim_current / m.amplitude_scale;
+      m.stim_onFlag = false;
+
+      if (m.recording)
+        m.dataRecord_stop();
+      m.protocolDone(true);
+    }
+    // If no action potential occurred, and Vm is back to rest, and the cell
+    // has rested for 200ms since returning to baseline
+    else if (m.time - m.stim_responseTime > 200) {
+      // Increase the magnitude of the stimulus and try again
+      m.stim_stimulusLevel += 0.1;
+
+      // Record the time of stimulus application
+      m.stim_startTime = m.time;
+      m.bcl_startTime = m.time_int;
+
+      // Search fails once stimulus passes limit of sequence step
+      if (m.stim_maxLevel > 0 && m.stim_stimulusLevel > m.stim_maxLevel) {
+        m.stim_onFlag = false;
+        m.output(0) = 0;
+
+        if (m.recording)
+          m.dataRecord_stop();
+        m.protocolDone(false);
+      }
+    }
+  }
+}; // Struct StimThresholdMode
+
+// Latency test pulses, output is held at 0 between pulses
+struct LatencyMode {
+  template <typename Host>
+  static void tick(Host &m) {
+    // Pulse amplitude in nA, convert to A
+    m.outputCurrent =
+        m.latency_probe.step(m.voltage) ? m.latency_amplitude * 1e-9 : 0;
+    m.output(0) = m.outputCurrent;
+    if (m.latency_probe.done()) {
+      m.latency_onFlag = false;
+      m.output(0) = 0;
+      m.protocolDone(m.latency_probe.valid());
+    }
+  }
+}; // Struct LatencyMode
+
+// Capacitance test steps, output is held at 0 between steps
+struct CapacitanceMode {
+  template <typename Host>
+  static void tick(Host &m) {
+    // Step amplitude in nA, convert to A
+    m.outputCurrent = m.cm_probe.step(m.voltage) ? m.cm_amplitude * 1e-9 : 0;
+    m.output(0) = m.outputCurrent;
+    if (m.cm_probe.done()) {
+      m.cm_onFlag = false;
+      m.output(0) = 0;
+      m.protocolDone(true);
+    }
+  }
+}; // Struct CapacitanceMode
+}; // Namespace RRC
+
+#endif // RRC_MODES_H
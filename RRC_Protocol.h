@@ -0,0 +1,175 @@
+#ifndef RRC_PROTOCOL_H
+#define RRC_PROTOCOL_H
+
+#include <cmath>
+
+// Protocol steps shared by the module and its stand-ins. As the modes of
+// RRC_Modes.h, they are templates on the host, so the simulated experiments
+// of tools/rrc_scenarios.cpp run the module's own code. Hosts call them from
+// their member functions of the same name and provide the hook:
+//   void addRestitutionPoint(di, apd)   Takes a point of restitution curve
+namespace RRC {
+struct Protocol {
+  // Restarts protocol time, beats and APD detection. Nothing is allocated, so
+  // steps of a sequence are restarted from the real-time thread
+  template <typename Host>
+  static void restart(Host &m) {
+    m.bcl_int = m.bcl / m.period;
+
+    m.time = -m.period;
+    m.time_int = -1;
+    m.bcl_startTime = 0;
+    m.beatNumber = 1;
+    m.beatNumber_int = 1;
+
+    m.apd_detector.start(m.time, m.voltage);
+    m.beat_apd = -1;
+
+    // No injection until the first random draw of RRC protocol
+    m.rrc_random_injection = 101;
+    m.rrc_random_threshold = 0;
+    m.rrc_injectionAmplitude = 0;
+
+    // Dynamic clamp gates start at steady state at the current voltage
+    m.dc_xr1 = 1 / (1 + std::exp((-26 - m.voltage) / 7));
+    m.dc_xr2 = 1 / (1 + std::exp((m.voltage + 88) / 24));
+    m.dc_current = 0;
+  }
+
+  // APD calculation, detection is shared with offline tools through
+  // RRC::APDDetector
+  template <typename Host>
+  static void calculateAPD(Host &m, int step) {
+    switch (step) {
+      case 1: // Called at each stimulus
+        m.apd_detector.beat(m.time, m.voltage);
+        // Decimation windows start at the stimulus
+        m.analysis_decimator.reset();
+        break;
+
+      case 2: // Called every tick, detection runs on decimated samples
+        if (m.analysis_decimator.push(m.time, m.voltage) &&
+            m.apd_detector.step(m.analysis_decimator.time,
+                                m.analysis_decimator.voltage)) {
+          m.apd = m.apd_detector.apd;
+          m.beat_apd = m.apd;
+        }
+        break;
+    }
+  }
+
+  // Restitution step, called at each stimulus of restitution protocols with
+  // beat_apd of the beat that ended. Returns false when protocol is done
+  template <typename Host>
+  static bool restitutionBeat(Host &m) {
+    switch (m.rest_phase) {
+      case Host::REST_PACING:
+        // A step ends once APD has converged at its cycle length
+        m.rest_stepBeats++;
+        if (m.beat_apd > 0 && m.rest_previousAPD > 0 &&
+            std::fabs(m.beat_apd - m.rest_previousAPD) <= m.rest_tolerance)
+          m.rest_stableBeats++;
+        else
+          m.rest_stableBeats = 0;
+        m.rest_previousAPD = m.beat_apd;
+        if (m.rest_stableBeats < m.rest_convergedBeats &&
+            m.rest_stepBeats < m.rest_maxBeats)
+          return true;
+
+        if (m.execute_mode == Host::DYNAMICRESTITUTION) {
+          // Steady state APD at this BCL, end if 1:1 capture is lost
+          if (m.beat_apd <= 0)
+            return false;
+          m.addRestitutionPoint(m.rest_cycle - m.beat_apd, m.beat_apd);
+          startRestitutionStep(m, m.rest_cycle - m.rest_step);
+          return m.rest_step > 0 && m.rest_cycle >= m.rest_minBcl;
+        }
+
+        // S1 pacing is steady, the beat starting now is the last S1 and is
+        // followed by S2 after the S1-S2 interval
+        m.rest_phase = Host::REST_COUPLING;
+        m.bcl_int = m.rest_cycle / m.period;
+        return true;
+
+      case Host::REST_COUPLING: // S2 stimulus, S2 beat lasts one S1 BCL
+        m.rest_s1APD = m.beat_apd;
+        m.rest_phase = Host::REST_TEST;
+        m.bcl_int = m.bcl / m.period;
+        return true;
+
+      case Host::REST_TEST: // S2 beat ended, end if S2 fell in refractory
+        if (m.beat_apd <= 0 || m.rest_s1APD <= 0)
+          return false;
+        m.addRestitutionPoint(m.rest_cycle - m.rest_s1APD, m.beat_apd);
+        startRestitutionStep(m, m.rest_cycle - m.rest_step);
+        return m.rest_step > 0 && m.rest_cycle >= m.rest_minBcl;
+    }
+    return false;
+  }
+
+  // Starts pacing for the next cycle length. Dynamic restitution paces at the
+  // cycle length, S1-S2 restitution paces at S1 BCL before testing it
+  template <typename Host>
+  static void startRestitutionStep(Host &m, double cycle) {
+    m.rest_cycle = cycle;
+    m.rest_phase = Host::REST_PACING;
+    m.rest_stableBeats = 0;
+    m.rest_stepBeats = 0;
+    m.rest_previousAPD = -1;
+    if (m.execute_mode == Host::DYNAMICRESTITUTION)
+      m.bcl_int = m.rest_cycle / m.period;
+    else
+      m.bcl_int = m.bcl / m.period;
+  }
+
+  // Dynamic clamp, returns current to inject (nA). Gating follows ten
+  // Tusscher & Panfilov 2006, integrated with one Rush-Larsen step per RTXI
+  // period so the cost is fixed and no memory is allocated
+  template <typename Host>
+  static double calculateDynamicClamp(Host &m) {
+    double xK1_inf, aK1, bK1;
+    double xr1_inf, xr1_tau, xr2_inf, xr2_tau;
+
+    double v = m.voltage;
+
+    switch (m.dc_model) {
+      case Host::DC_IKR:
+        xr1_inf = 1 / (1 + std::exp((-26 - v) / 7));
+        xr1_tau = (450 / (1 + std::exp((-45 - v) / 10))) *
+            (6 / (1 + std::exp((v + 30) / 11.5)));
+        xr2_inf = 1 / (1 + std::exp((v + 88) / 24));
+        xr2_tau = (3 / (1 + std::exp((-60 - v) / 20))) *
+            (1.12 / (1 + std::exp((v - 60) / 20)));
+
+        m.dc_xr1 = xr1_inf -
+            (xr1_inf - m.dc_xr1) * std::exp(-m.period / xr1_tau);
+        m.dc_xr2 = xr2_inf -
+            (xr2_inf - m.dc_xr2) * std::exp(-m.period / xr2_tau);
+
+        // nS * mV = pA, convert to nA
+        m.dc_current =
+            -m.dc_conductance * m.dc_xr1 * m.dc_xr2 * (v - m.dc_ek) * 1e-3;
+        break;
+
+      case Host::DC_IK1: // Instantaneous inward rectifier, no gating state
+        aK1 = 0.1 / (1 + std::exp(0.06 * (v - m.dc_ek - 200)));
+        bK1 = (3 * std::exp(0.0002 * (v - m.dc_ek + 100)) +
+               std::exp(0.1 * (v - m.dc_ek - 10))) /
+            (1 + std::exp(-0.5 * (v - m.dc_ek)));
+        xK1_inf = aK1 / (aK1 + bK1);
+
+        // nS * mV = pA, convert to nA
+        m.dc_current = -m.dc_conductance * xK1_inf * (v - m.dc_ek) * 1e-3;
+        break;
+
+      default: // DC_OFF
+        m.dc_current = 0;
+        break;
+    }
+
+    return m.dc_current;
+  }
+}; // Struct Protocol
+}; // Namespace RRC
+
+#endif // RRC_PROTOCOL_H
@@ -0,0 +1,31 @@
+#ifndef RRC_RANDOM_H
+#define RRC_RANDOM_H
+
+#include <cstdint>
+
+// Xorshift random numbers for the RRC protocol. The whole state is one
+// word, so it is saved in checkpoints and a resumed protocol continues the
+// same sequence of draws. Safe to call from the real-time thread.
+namespace RRC {
+class Random {
+ public:
+  Random() { seed(1); }
+
+  // State must not be 0
+  void seed(uint32_t value) { word = value ? value : 0x9e3779b9u; }
+
+  uint32_t state() const { return word; }
+
+  uint32_t next() {
+    word ^= word << 13;
+    word ^= word >> 17;
+    word ^= word << 5;
+    return word;
+  }
+
+ private:
+  uint32_t word;
+}; // Class Random
+}; // Namespace RRC
+
+#endif // RRC_RANDOM_H
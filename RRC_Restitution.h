@@ -0,0 +1,102 @@
+#ifndef RRC_RESTITUTION_H
+#define RRC_RESTITUTION_H
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// Restitution curve of APD against the preceding diastolic interval (DI)
+namespace RRC {
+struct RestitutionPoint {
+  double cycleLength; // BCL of dynamic step or S1-S2 interval (ms)
+  double di; // Diastolic interval preceding the measured AP (ms)
+  double apd; // APD of measured AP (ms)
+  int beats; // Beats paced at cycle length before point was taken
+  bool converged; // False if step ended at its maximum beat count
+};
+
+// Fit of APD = apdMax - amplitude * exp(-DI / tau). For each tau of a fixed
+// log spaced grid the model is linear in apdMax and amplitude, so a new point
+// only updates running sums and the fit is the tau with least squared error.
+class RestitutionFit {
+ public:
+  explicit RestitutionFit(double tauMin = 5, double tauMax = 2000,
+                          int taus = 64) : sums(taus) {
+    for (int i = 0; i < taus; i++)
+      tauGrid.push_back(tauMin *
+                        std::pow(tauMax / tauMin, i / (taus - 1.0)));
+    clear();
+  }
+
+  void clear() {
+    for (size_t i = 0; i < sums.size(); i++)
+      sums[i] = Sums();
+    points = 0;
+    minDi = 0;
+  }
+
+  void add(double di, double apd) {
+    for (size_t i = 0; i < tauGrid.size(); i++) {
+      double e = std::exp(-di / tauGrid[i]);
+      sums[i].n += 1;
+      sums[i].e += e;
+      sums[i].ee += e * e;
+      sums[i].y += apd;
+      sums[i].ey += e * apd;
+      sums[i].yy += apd * apd;
+    }
+    if (points == 0 || di < minDi)
+      minDi = di;
+    points++;
+  }
+
+  size_t size() const { return points; }
+
+  // Returns false until there are enough points for a fit
+  bool fit(double &apdMax, double &amplitude, double &tau) const {
+    if (points < 3)
+      return false;
+
+    bool found = false;
+    double bestError = 0;
+    for (size_t i = 0; i < tauGrid.size(); i++) {
+      const Sums &s = sums[i];
+      double det = s.n * s.ee - s.e * s.e;
+      if (det <= 1e-12 * s.n * s.n) // Exponential flat over all points
+        continue;
+      double c0 = (s.ee * s.y - s.e * s.ey) / det;
+      double c1 = (s.n * s.ey - s.e * s.y) / det;
+      double error = s.yy - c0 * s.y - c1 * s.ey;
+      if (!found || error < bestError) {
+        found = true;
+        bestError = error;
+        apdMax = c0;
+        amplitude = -c1;
+        tau = tauGrid[i];
+      }
+    }
+    return found;
+  }
+
+  // Maximum slope of the fitted curve, at the shortest DI measured
+  double maxSlope() const {
+    double apdMax, amplitude, tau;
+    if (!fit(apdMax, amplitude, tau))
+      return 0;
+    return amplitude / tau * std::exp(-minDi / tau);
+  }
+
+ private:
+  struct Sums {
+    Sums() : n(0), e(0), ee(0), y(0), ey(0), yy(0) {}
+    double n, e, ee, y, ey, yy;
+  };
+
+  std::vector<double> tauGrid;
+  std::vector<Sums> sums; // Running sums for each tau of grid
+  size_t points;
+  double minDi; // Shortest DI added
+}; // Class RestitutionFit
+}; // Namespace RRC
+
+#endif // RRC_RESTITUTION_H
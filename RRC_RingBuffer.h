@@ -0,0 +1,74 @@
+#ifndef RRC_RINGBUFFER_H
+#define RRC_RINGBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Single producer, single consumer lock-free ring buffer. Storage is
+// allocated once at construction, so push and pop never allocate and are
+// safe to call from the real-time thread.
+namespace RRC {
+template <typename T>
+class RingBuffer {
+ public:
+  // Capacity is rounded up to a power of two
+  explicit RingBuffer(size_t capacity) : head(0), tail(0) {
+    size_t size = 1;
+    while (size < capacity)
+      size <<= 1;
+    buffer.resize(size);
+    mask = size - 1;
+  }
+
+  size_t capacity() const { return buffer.size(); }
+
+  // Number of items waiting to be popped
+  size_t size() const {
+    return head.load(std::memory_order_acquire) -
+        tail.load(std::memory_order_acquire);
+  }
+
+  // Producer only. Returns false if buffer is full
+  bool push(const T &item) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == buffer.size())
+      return false;
+    buffer[h & mask] = item;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only. Copies up to max items and returns how many were copied
+  size_t pop(T *items, size_t max) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t available = head.load(std::memory_order_acquire) - t;
+    size_t n = available < max ? available : max;
+    for (size_t i = 0; i < n; i++)
+      items[i] = buffer[(t + i) & mask];
+    tail.store(t + n, std::memory_order_release);
+    return n;
+  }
+
+  bool pop(T &item) {
+    return pop(&item, 1) == 1;
+  }
+
+  // Only call while neither producer nor consumer is running
+  void clear() {
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+  }
+
+ private:
+  std::vector<T> buffer;
+  size_t mask;
+  // Padded onto separate cache lines so producer and consumer do not contend
+  char padding0[64];
+  std::atomic<size_t> head;
+  char padding1[64];
+  std::atomic<size_t> tail;
+}; // Class RingBuffer
+}; // Namespace RRC
+
+#endif // RRC_RINGBUFFER_H
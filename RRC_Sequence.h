@@ -0,0 +1,168 @@
+#ifndef RRC_SEQUENCE_H
+#define RRC_SEQUENCE_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <istream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Unattended experiment sequence. A script lists protocols that are run back
+// to back, one step per line:
+//
+//   [label:] mode [beats=N] [max=X] [next=label] [fail=label|next|stop]
+//
+// Modes are stim_threshold, pace, rrc_threshold and rrc_protocol. Pace steps
+// need beats=N. max=X fails a threshold search once its stimulus or RRC
+// amplitude passes X, in the units of the module's amplitudes: nA, or pA/pF
+// with Amplitudes in pA/pF checked. A step that succeeds continues with
+// next= or the following line, one that fails stops the sequence unless
+// fail= says otherwise. Text after # is ignored.
+namespace RRC {
+struct SequenceStep {
+  enum mode_t {STIMTHRESHOLD, PACE, RRCTHRESHOLD, RRCPROTOCOL};
+
+  mode_t mode;
+  int beats; // Beats to pace, pace only
+  double limit; // Amplitude that fails a threshold search, 0 for none
+  int next; // Step after success, -1 ends sequence
+  int failure; // Step after failure, -1 ends sequence
+  std::string label; // Label or mode name, for display
+};
+
+// Steps taken before a sequence is stopped, guards against fail= loops
+static const int sequenceMaxTransitions = 100;
+
+// Returns false and describes the first problem in error if script is invalid
+inline bool parseSequence(std::istream &script,
+                          std::vector<SequenceStep> &steps,
+                          std::string &error) {
+  static const char *modeNames[] = {"stim_threshold", "pace", "rrc_threshold",
+                                    "rrc_protocol"};
+  std::vector<SequenceStep> parsed;
+  std::vector<std::string> nextLabels;
+  std::vector<std::string> failLabels;
+  std::vector<int> lineNumbers;
+  std::map<std::string, int> labels;
+  std::string line;
+
+  for (int lineNumber = 1; std::getline(script, line); lineNumber++) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream words(line);
+    std::string word;
+    if (!(words >> word))
+      continue;
+
+    std::ostringstream where;
+    where << "Line " << lineNumber << ": ";
+
+    SequenceStep step;
+    step.beats = 0;
+    step.limit = 0;
+    std::string label;
+    if (word[word.size() - 1] == ':') {
+      label = word.substr(0, word.size() - 1);
+      if (label.empty() || labels.count(label)) {
+        error = where.str() + "missing or repeated label";
+        return false;
+      }
+      labels[label] = parsed.size();
+      if (!(words >> word)) {
+        error = where.str() + "label without mode";
+        return false;
+      }
+    }
+
+    int mode = 0;
+    while (mode < 4 && word != modeNames[mode])
+      mode++;
+    if (mode == 4) {
+      error = where.str() + "unknown mode " + word;
+      return false;
+    }
+    step.mode = static_cast<SequenceStep::mode_t>(mode);
+    step.label = label.empty() ? word : label;
+
+    std::string next = "next";
+    std::string fail = "stop";
+    while (words >> word) {
+      size_t equals = word.find('=');
+      std::string key = word.substr(0, equals);
+      std::string value = equals == std::string::npos ?
+          "" : word.substr(equals + 1);
+      if (key == "beats")
+        step.beats = std::atoi(value.c_str());
+      else if (key == "max")
+        step.limit = std::atof(value.c_str());
+      else if (key == "next" && !value.empty())
+        next = value;
+      else if (key == "fail" && !value.empty())
+        fail = value;
+      else {
+        error = where.str() + "unknown option " + word;
+        return false;
+      }
+    }
+    if (step.mode == SequenceStep::PACE && step.beats <= 0) {
+      error = where.str() + "pace needs beats=N";
+      return false;
+    }
+
+    parsed.push_back(step);
+    nextLabels.push_back(next);
+    failLabels.push_back(fail);
+    lineNumbers.push_back(lineNumber);
+  }
+
+  if (parsed.empty()) {
+    error = "Sequence has no steps";
+    return false;
+  }
+
+  // Resolve branches once every label is known
+  for (size_t i = 0; i < parsed.size(); i++) {
+    const std::string *targets[] = {&nextLabels[i], &failLabels[i]};
+    int *indices[] = {&parsed[i].next, &parsed[i].failure};
+    for (int j = 0; j < 2; j++) {
+      if (*targets[j] == "next")
+        *indices[j] = i + 1 < parsed.size() ? i + 1 : -1;
+      else if (*targets[j] == "stop")
+        *indices[j] = -1;
+      else if (labels.count(*targets[j]))
+        *indices[j] = labels[*targets[j]];
+      else {
+        std::ostringstream message;
+        message << "Line " << lineNumbers[i] << ": unknown label " <<
+            *targets[j];
+        error = message.str();
+        return false;
+      }
+    }
+  }
+
+  steps.swap(parsed);
+  return true;
+}
+
+// Identity of parsed steps, FNV-1a hash of their fields. Saved in
+// checkpoints, so a sequence is only resumed with the same steps loaded
+inline uint32_t sequenceId(const std::vector<SequenceStep> &steps) {
+  std::ostringstream text;
+  for (size_t i = 0; i < steps.size(); i++)
+    text << steps[i].mode << ' ' << steps[i].beats << ' ' << steps[i].limit
+         << ' ' << steps[i].next << ' ' << steps[i].failure << ' '
+         << steps[i].label << '\n';
+
+  std::string data = text.str();
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < data.size(); i++) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+}; // Namespace RRC
+
+#endif // RRC_SEQUENCE_H
@@ -0,0 +1,114 @@
+#ifndef RRC_STATISTICS_H
+#define RRC_STATISTICS_H
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// Beat-to-beat variability of a series such as APD. Every statistic is
+// updated in constant time per beat, so it can run for the whole protocol.
+namespace RRC {
+class BeatStatistics {
+ public:
+  // Window is the number of beat-to-beat differences used by STV, alternans
+  // uses the same number of beats
+  explicit BeatStatistics(size_t window = 30) {
+    resize(window);
+  }
+
+  // Clears statistics and sets window size, allocates
+  void resize(size_t window) {
+    if (window < 2)
+      window = 2;
+    values.assign(window, 0);
+    differences.assign(window, 0);
+    clear();
+  }
+
+  void clear() {
+    n = 0;
+    runningMean = 0;
+    m2 = 0;
+    previous = 0;
+    differenceSum = 0;
+    evenSum = 0;
+    oddSum = 0;
+  }
+
+  void add(double x) {
+    size_t window = values.size();
+
+    // Welford's running mean and variance
+    double delta = x - runningMean;
+    runningMean += delta / (n + 1);
+    m2 += delta * (x - runningMean);
+
+    // Poincare distance to previous beat, summed over the last window
+    // differences
+    if (n > 0) {
+      size_t d = (n - 1) % window;
+      double difference = std::fabs(x - previous);
+      if (n > window)
+        differenceSum -= differences[d];
+      differences[d] = difference;
+      differenceSum += difference;
+    }
+    previous = x;
+
+    // Even and odd beats of the last window beats
+    size_t i = n % window;
+    if (n >= window) {
+      if ((n - window) % 2 == 0)
+        evenSum -= values[i];
+      else
+        oddSum -= values[i];
+    }
+    values[i] = x;
+    if (n % 2 == 0)
+      evenSum += x;
+    else
+      oddSum += x;
+
+    n++;
+  }
+
+  size_t count() const { return n; }
+  double mean() const { return runningMean; }
+  double variance() const { return n > 1 ? m2 / (n - 1) : 0; }
+  double sd() const { return std::sqrt(variance()); }
+
+  // Short-term variability, sum |x[i+1] - x[i]| / (differences * sqrt(2))
+  double stv() const {
+    if (n < 2)
+      return 0;
+    size_t window = differences.size();
+    size_t used = n - 1 < window ? n - 1 : window;
+    return differenceSum / (used * std::sqrt(2.0));
+  }
+
+  // Alternans magnitude, |mean of even beats - mean of odd beats|
+  double alternans() const {
+    size_t window = values.size();
+    size_t used = n < window ? n : window;
+    if (used < 2)
+      return 0;
+    // Beats in window alternate parity, oldest is even if n - used is even
+    size_t first = (n - used) % 2 == 0 ? (used + 1) / 2 : used / 2;
+    size_t second = used - first;
+    return std::fabs(evenSum / first - oddSum / second);
+  }
+
+ private:
+  size_t n; // Values added
+  double runningMean;
+  double m2; // Sum of squared differences from mean
+  double previous; // Last value added
+  std::vector<double> differences; // Last beat-to-beat differences
+  double differenceSum;
+  std::vector<double> values; // Last values, for alternans
+  double evenSum; // Sum of values in window with even index
+  double oddSum; // Sum of values in window with odd index
+}; // Class BeatStatistics
+}; // Namespace RRC
+
+#endif // RRC_STATISTICS_H
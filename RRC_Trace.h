@@ -0,0 +1,307 @@
+#ifndef RRC_TRACE_H
+#define RRC_TRACE_H
+
+#include "RRC_RingBuffer.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <utility>
+
+// Raw trace format: a 4096 byte header followed by one fixed size record per
+// RTXI tick. Records are appended in large page aligned blocks by a non-RT
+// thread and read back by memory mapping the file.
+namespace RRC {
+struct TraceRecord {
+  double time; // Time elapsed during protocol (ms)
+  double voltage; // Membrane voltage of cell (mV)
+  double current; // Output current (A)
+  int32_t beatNumber; // Beat of protocol, counted on over sequence steps
+  int32_t mode; // Execute mode of module
+};
+
+struct TraceHeader {
+  char magic[8]; // "RRCTRACE"
+  uint32_t version;
+  uint32_t recordSize; // sizeof(TraceRecord)
+  uint64_t headerSize; // Offset of first record
+  uint64_t records; // Number of records, 0 if writer did not finish
+  double period; // RTXI thread period (ms)
+};
+
+static const char traceMagic[8] = {'R', 'R', 'C', 'T', 'R', 'A', 'C', 'E'};
+static const uint32_t traceVersion = 1;
+static const size_t traceHeaderSize = 4096;
+static const size_t traceBlockSize = 1 << 20; // Bytes written per block
+
+// Hands records from the RT thread to a writer thread that stores them in
+// fixed size blocks. Derived classes choose how a block is written to disk.
+class TraceSink {
+ public:
+  // Capacity is the number of ticks buffered between RT and writer threads
+  TraceSink(size_t capacity, size_t blockRecords) :
+      ring(capacity), running(false), droppedRecords(0), failed(false),
+      fd(-1), period(0), block(NULL), blockRecords(blockRecords),
+      blockFill(0) {}
+
+  virtual ~TraceSink() {
+    free(block);
+  }
+
+  // Non-RT. Creates file and starts writer thread
+  bool open(const std::string &fileName, double period) {
+    close();
+
+    fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      return false;
+    if (!block &&
+        posix_memalign(reinterpret_cast<void **>(&block), traceHeaderSize,
+                       blockRecords * sizeof(TraceRecord)) != 0) {
+      block = NULL;
+      ::close(fd);
+      fd = -1;
+      return false;
+    }
+
+    this->period = period;
+    blockFill = 0;
+    droppedRecords = 0;
+    failed = false;
+    ring.clear();
+    begin();
+
+    running = true;
+    thread = std::thread(&TraceSink::run, this);
+    return true;
+  }
+
+  // Non-RT. Writes remaining records, completes file and closes it
+  void close() {
+    if (!thread.joinable())
+      return;
+
+    running = false;
+    thread.join();
+    finish();
+    ::close(fd);
+    fd = -1;
+  }
+
+  bool isOpen() const {
+    return running.load(std::memory_order_relaxed);
+  }
+
+  // RT. Records that do not fit in the buffer are counted and dropped
+  void push(const TraceRecord &record) {
+    if (!ring.push(record))
+      droppedRecords.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  unsigned long dropped() const {
+    return droppedRecords.load(std::memory_order_relaxed);
+  }
+
+  bool error() const {
+    return failed.load(std::memory_order_relaxed);
+  }
+
+ protected:
+  // Called from open() before writer thread starts
+  virtual void begin() = 0;
+  // Called from writer thread with each full block and the final partial one
+  virtual void writeBlock(const TraceRecord *records, size_t n) = 0;
+  // Called from close() after writer thread stops
+  virtual void finish() = 0;
+
+  // Writes all bytes at offset, sets error flag on failure
+  void writeAt(const void *data, size_t bytes, off_t offset) {
+    const char *p = static_cast<const char *>(data);
+    while (bytes > 0 && !failed) {
+      ssize_t written = pwrite(fd, p, bytes, offset);
+      if (written < 0)
+        failed = true;
+      else {
+        p += written;
+        offset += written;
+        bytes -= written;
+      }
+    }
+  }
+
+  RingBuffer<TraceRecord> ring;
+  std::thread thread;
+  std::atomic<bool> running;
+  std::atomic<unsigned long> droppedRecords;
+  std::atomic<bool> failed;
+  int fd;
+  double period;
+
+ private:
+  void run() {
+    for (;;) {
+      bool stopping = !running.load(std::memory_order_acquire);
+      size_t n = ring.pop(block + blockFill, blockRecords - blockFill);
+      blockFill += n;
+      if (blockFill == blockRecords) {
+        writeBlock(block, blockFill);
+        blockFill = 0;
+      }
+      else if (n == 0) {
+        if (stopping)
+          break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      }
+    }
+    // Final partial block
+    if (blockFill > 0)
+      writeBlock(block, blockFill);
+    blockFill = 0;
+  }
+
+  TraceRecord *block; // Aligned block being filled by writer thread
+  size_t blockRecords; // Records per block
+  size_t blockFill; // Records in block
+}; // Class TraceSink
+
+// Writes records unchanged after the header, one block at a time
+class TraceWriter : public TraceSink {
+ public:
+  explicit TraceWriter(size_t capacity = 1 << 18) :
+      TraceSink(capacity, traceBlockSize / sizeof(TraceRecord)), records(0) {}
+
+  ~TraceWriter() {
+    close();
+  }
+
+ protected:
+  void begin() {
+    records = 0;
+    writeHeader();
+  }
+
+  void writeBlock(const TraceRecord *block, size_t n) {
+    writeAt(block, n * sizeof(TraceRecord),
+            traceHeaderSize + records * sizeof(TraceRecord));
+    records += n;
+  }
+
+  void finish() {
+    writeHeader();
+  }
+
+ private:
+  void writeHeader() {
+    char buffer[traceHeaderSize];
+    std::memset(buffer, 0, sizeof(buffer));
+    TraceHeader header;
+    std::memcpy(header.magic, traceMagic, sizeof(header.magic));
+    header.version = traceVersion;
+    header.recordSize = sizeof(TraceRecord);
+    header.headerSize = traceHeaderSize;
+    header.records = records;
+    header.period = period;
+    std::memcpy(buffer, &header, sizeof(header));
+    writeAt(buffer, sizeof(buffer), 0);
+  }
+
+  uint64_t records; // Records written to file
+}; // Class TraceWriter
+
+class TraceReader {
+ public:
+  TraceReader() :
+      mapped(NULL), length(0), records(NULL), count(0), periodMs(0) {}
+
+  ~TraceReader() {
+    close();
+  }
+
+  // Maps file into memory, records are then read without copying
+  bool open(const std::string &fileName) {
+    close();
+
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 ||
+        static_cast<size_t>(info.st_size) < traceHeaderSize) {
+      ::close(fd);
+      return false;
+    }
+    length = info.st_size;
+    void *address = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED)
+      return false;
+    mapped = static_cast<const char *>(address);
+
+    const TraceHeader *header = reinterpret_cast<const TraceHeader *>(mapped);
+    if (std::memcmp(header->magic, traceMagic, sizeof(traceMagic)) != 0 ||
+        header->version != traceVersion ||
+        header->recordSize != sizeof(TraceRecord) ||
+        header->headerSize != traceHeaderSize) {
+      close();
+      return false;
+    }
+
+    // Header count is 0 if writer did not finish, use what reached the disk
+    count = (length - traceHeaderSize) / sizeof(TraceRecord);
+    if (header->records > 0 && header->records < count)
+      count = header->records;
+    records = reinterpret_cast<const TraceRecord *>(mapped + traceHeaderSize);
+    periodMs = header->period;
+    return true;
+  }
+
+  void close() {
+    if (mapped)
+      munmap(const_cast<char *>(mapped), length);
+    mapped = NULL;
+    records = NULL;
+    length = 0;
+    count = 0;
+  }
+
+  size_t size() const { return count; }
+  double period() const { return periodMs; }
+  const TraceRecord &operator[](size_t i) const { return records[i]; }
+  const TraceRecord *begin() const { return records; }
+  const TraceRecord *end() const { return records + count; }
+
+  // Index range [first, last) of a beat's records. Beat number never
+  // decreases within a trace, the module numbers the beats of a sequence on
+  // from step to step, so the range is found by binary search
+  std::pair<size_t, size_t> beat(int beatNumber) const {
+    const TraceRecord *first = std::lower_bound(begin(), end(), beatNumber,
+                                                beforeBeat);
+    const TraceRecord *last = std::lower_bound(first, end(), beatNumber + 1,
+                                               beforeBeat);
+    return std::make_pair(first - begin(), last - begin());
+  }
+
+ private:
+  static bool beforeBeat(const TraceRecord &record, int beatNumber) {
+    return record.beatNumber < beatNumber;
+  }
+
+  const char *mapped;
+  size_t length;
+  const TraceRecord *records;
+  size_t count;
+  double periodMs;
+}; // Class TraceReader
+}; // Namespace RRC
+
+#endif // RRC_TRACE_H
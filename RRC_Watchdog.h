@@ -0,0 +1,71 @@
+#ifndef RRC_WATCHDOG_H
+#define RRC_WATCHDOG_H
+
+// Safety checks of a running protocol, evaluated in the RT thread. Each check
+// keeps a single counter, so the cost per tick is a few comparisons. A check
+// is disabled by setting its limit to 0.
+namespace RRC {
+class Watchdog {
+ public:
+  enum reason_t {NONE, VOLTAGE_RANGE, MISSING_AP, STUCK_DOWN};
+
+  Watchdog() :
+      vMin(-150), vMax(100), rangeTime(1000), missedBeats(10),
+      stuckBeats(5) {
+    start();
+  }
+
+  // Clears counters at start of protocol
+  void start() {
+    reason = NONE;
+    outOfRange = 0;
+    missed = 0;
+    stuck = 0;
+  }
+
+  // Called every tick, returns true on the tick the watchdog trips
+  bool tick(double voltage, double period) {
+    if (voltage < vMin || voltage > vMax)
+      outOfRange += period;
+    else
+      outOfRange = 0;
+    if (rangeTime > 0 && outOfRange >= rangeTime)
+      return trip(VOLTAGE_RANGE);
+    return false;
+  }
+
+  // Called at each stimulus that ends a beat, with its result. apFound is
+  // false if no AP was detected, detectorDown if the APD detector is still
+  // waiting for repolarization
+  bool beat(bool apFound, bool detectorDown) {
+    missed = apFound ? 0 : missed + 1;
+    stuck = detectorDown ? stuck + 1 : 0;
+    if (missedBeats > 0 && missed >= missedBeats)
+      return trip(MISSING_AP);
+    if (stuckBeats > 0 && stuck >= stuckBeats)
+      return trip(STUCK_DOWN);
+    return false;
+  }
+
+  // Settings
+  double vMin; // Lowest voltage allowed (mV)
+  double vMax; // Highest voltage allowed (mV)
+  double rangeTime; // Time out of range that trips watchdog (ms)
+  int missedBeats; // Consecutive beats without AP that trip watchdog
+  int stuckBeats; // Consecutive stimuli during repolarization search
+
+  reason_t reason; // Check that tripped, NONE if running
+
+ private:
+  bool trip(reason_t why) {
+    reason = why;
+    return true;
+  }
+
+  double outOfRange; // Time voltage has been out of range (ms)
+  int missed;
+  int stuck;
+}; // Class Watchdog
+}; // Namespace RRC
+
+#endif // RRC_WATCHDOG_H
@@ -0,0 +1,422 @@
+// Benchmark of the per-tick cost of the module's protocol modes
+//
+// Runs each paced mode of RRC_Modes.h on a stand-in for the module, once
+// through the mode tick pointer the module now uses and once through the
+// switch execute() used before, kept below as the reference. Both run the
+// same host functions (APD detector, beat capture) on a synthetic action
+// potential, and their outputs are compared tick by tick through a checksum.
+//
+// Usage: rrc_dispatch_bench [ticks]   (default: 20000000 per run)
+
+#include "RRC_APD.h"
+#include "RRC_Modes.h"
+#include "RRC_Random.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+// Members of RRC::Module used by the paced modes, with the module's defaults
+struct Host {
+  enum execute_mode_t {IDLE, STIMTHRESHOLD, PACE, RRCTHRESHOLD, RRCPROTOCOL,
+                       S1S2RESTITUTION, DYNAMICRESTITUTION, LATENCYTEST};
+
+  struct Analyzer {
+    void endBeat(double apd) { lastApd = apd; }
+    double lastApd;
+  };
+
+  explicit Host(execute_mode_t mode) :
+      time(-0.1), voltage(-85), beatNumber(1), apd(0), period(0.1),
+      stim_amplitude(4), stim_current(4e-9), amplitude_scale(1e-9),
+      time_int(-1), bcl_int(5000), stim_length_int(10),
+      beatNumber_int(1), outputCurrent(0), recording(false),
+      execute_mode(mode), pace_recordData(false), pace_endBeat(0),
+      bcl_startTime(0), pace_onFlag(true), thresh_recordData(false),
+      thresh_beatNumber(3), thresh_apdCutoff(1000), thresh_rrcThreshFound(false),
+      thresh_previousAPD(-1), thresh_rrcAmplitude(0),
+      thresh_ampIncrement(0.01), thresh_maxAmplitude(0), thresh_onFlag(true),
+      rrcProtocol_onFlag(true), rrcProtocol_recordData(false),
+      rrc_amplitude(0.5), rrc_thresholdWindow(10), rrc_beatNumber(3),
+      rrc_chance(50), rrc_endBeatNumber(1 << 30), rrc_startTime(50),
+      rrc_endTime(5000), rrc_random_injection(0), rrc_random_threshold(0),
+      rrc_injectionAmplitude(0), rest_onFlag(true), rest_recordData(false),
+      beat_apd(-1), capture(5000), captureFill(0), output0(0), done(false) {
+    rrc_waveform.assign(rrc_endTime - rrc_startTime, 1.0);
+  }
+
+  double &output(int) { return output0; }
+  void dataRecord_start() { recording = true; }
+  void dataRecord_stop() { recording = false; }
+  void protocolDone(bool) { done = true; }
+  bool restitutionBeat() { return true; }
+  double calculateDynamicClamp() { return 0; } // Dynamic clamp off
+
+  void calculateAPD(int step) {
+    switch (step) {
+      case 1:
+        apd_detector.beat(time, voltage);
+        break;
+
+      case 2:
+        if (apd_detector.step(time, voltage)) {
+          apd = apd_detector.apd;
+          beat_apd = apd;
+        }
+        break;
+    }
+  }
+
+  void captureBeat() {
+    if (time_int == bcl_startTime) {
+      beat_analyzer.endBeat(beat_apd);
+      captureFill = 0;
+      beat_apd = -1;
+    }
+    if (captureFill < capture.size())
+      capture[captureFill++] = voltage;
+  }
+
+  double time;
+  double voltage;
+  double beatNumber;
+  double apd;
+  double period;
+  double stim_amplitude;
+  double stim_current;
+  double amplitude_scale;
+  int time_int;
+  int bcl_int;
+  int stim_length_int;
+  int beatNumber_int;
+  double outputCurrent;
+  bool recording;
+  execute_mode_t execute_mode;
+  bool pace_recordData;
+  int pace_endBeat;
+  int bcl_startTime;
+  bool pace_onFlag;
+  bool thresh_recordData;
+  int thresh_beatNumber;
+  int thresh_apdCutoff;
+  bool thresh_rrcThreshFound;
+  double thresh_previousAPD;
+  double thresh_rrcAmplitude;
+  double thresh_ampIncrement;
+  double thresh_maxAmplitude;
+  bool thresh_onFlag;
+  bool rrcProtocol_onFlag;
+  bool rrcProtocol_recordData;
+  double rrc_amplitude;
+  int rrc_thresholdWindow;
+  int rrc_beatNumber;
+  int rrc_chance;
+  int rrc_endBeatNumber;
+  int rrc_startTime;
+  int rrc_endTime;
+  int rrc_random_injection;
+  int rrc_random_threshold;
+  RRC::Random rrc_random;
+  double rrc_injectionAmplitude;
+  std::vector<double> rrc_waveform;
+  bool rest_onFlag;
+  bool rest_recordData;
+  RRC::APDDetector apd_detector;
+  Analyzer beat_analyzer;
+  double beat_apd;
+  std::vector<double> capture;
+  size_t captureFill;
+  double output0;
+  bool done;
+};
+
+// Protocol part of execute() before the mode types, paced modes only
+__attribute__((noinline)) void switchTick(Host &m) {
+  switch (m.execute_mode) {
+    case Host::PACE: // Static pacing
+      m.time += m.period;
+      m.time_int += 1;
+
+      if (m.time_int == 0 && m.pace_recordData && !m.recording)
+        m.dataRecord_start();
+
+      // If time is greater than BCL, advance the beat
+      if (m.time_int - m.bcl_startTime >= m.bcl_int) {
+        if (m.pace_endBeat > 0 && m.beatNumber >= m.pace_endBeat) {
+          m.beat_analyzer.endBeat(m.beat_apd);
+          m.pace_onFlag = false;
+          m.output(0) = 0;
+
+          if (m.recording)
+            m.dataRecord_stop();
+          m.protocolDone(m.beat_apd > 0);
+          break;
+        }
+
+        m.beatNumber++;
+        m.bcl_startTime = m.time_int;
+        m.calculateAPD(1);
+      }
+
+      if ((m.time_int - m.bcl_startTime) < m.stim_length_int)
+        m.outputCurrent = m.stim_amplitude * 1e-9;
+      else
+        m.outputCurrent = 0;
+      m.outputCurrent += m.calculateDynamicClamp() * 1e-9;
+
+      m.output(0) = m.outputCurrent;
+
+      m.calculateAPD(2);
+      m.captureBeat();
+      break;
+
+    case Host::RRCTHRESHOLD:
+      m.time += m.period;
+      m.time_int += 1;
+
+      if (m.time_int == 0 && m.thresh_recordData && !m.recording)
+        m.dataRecord_start();
+
+      if (m.time_int - m.bcl_startTime >= m.bcl_int) {
+        if (m.beatNumber_int % m.thresh_beatNumber == 0) {
+          if (m.thresh_previousAPD < 0)
+            m.thresh_previousAPD = m.apd;
+          else if (m.apd_detector.mode == RRC::APDDetector::DOWN)
+            m.thresh_rrcThreshFound = true;
+          else if (m.apd >= m.thresh_previousAPD *
+                   (1 + (m.thresh_apdCutoff / 100.0)))
+            m.thresh_rrcThreshFound = true;
+          else {
+            m.thresh_previousAPD = m.apd;
+            m.thresh_rrcAmplitude += m.thresh_ampIncrement;
+          }
+        }
+
+        bool threshFailed = m.thresh_maxAmplitude > 0 &&
+            m.thresh_rrcAmplitude > m.thresh_maxAmplitude;
+
+        if (m.thresh_rrcThreshFound || threshFailed) {
+          m.beat_analyzer.endBeat(m.beat_apd);
+          m.thresh_onFlag = false;
+          m.output(0) = 0;
+          if (m.thresh_rrcThreshFound)
+            m.rrc_amplitude = m.thresh_rrcAmplitude;
+
+          if (m.recording)
+            m.dataRecord_stop();
+          m.protocolDone(m.thresh_rrcThreshFound);
+          break;
+        }
+
+        m.beatNumber++;
+        m.beatNumber_int++;
+        m.bcl_startTime = m.time_int;
+        m.calculateAPD(1);
+
+        m.rrc_injectionAmplitude = m.thresh_rrcAmplitude * 1e-9;
+      }
+
+      m.outputCurrent = 0;
+      if ((m.time_int - m.bcl_startTime) < m.stim_length_int)
+        m.outputCurrent += m.stim_amplitude * 1e-9;
+      if (m.beatNumber_int % m.thresh_beatNumber == 0) {
+        if ((m.time_int - m.bcl_startTime) > m.rrc_startTime &&
+            (m.time_int - m.bcl_startTime) < m.rrc_endTime)
+          m.outputCurrent += m.rrc_injectionAmplitude *
+              m.rrc_waveform[m.time_int - m.bcl_startTime - m.rrc_startTime -
+                             1];
+      }
+      m.outputCurrent += m.calculateDynamicClamp() * 1e-9;
+      m.output(0) = m.outputCurrent;
+
+      m.calculateAPD(2);
+      m.captureBeat();
+      break;
+
+    case Host::RRCPROTOCOL:
+      m.time += m.period;
+      m.time_int += 1;
+
+      if (m.time_int == 0 && m.rrcProtocol_recordData && !m.recording)
+        m.dataRecord_start();
+
+      if (m.time_int - m.bcl_startTime >= m.bcl_int) {
+        if (m.beatNumber >= m.rrc_endBeatNumber) {
+          m.beat_analyzer.endBeat(m.beat_apd);
+          if (m.recording)
+            m.dataRecord_stop();
+
+          m.rrcProtocol_onFlag = false;
+          m.output(0) = 0;
+          m.protocolDone(true);
+          break;
+        }
+
+        m.beatNumber++;
+        m.beatNumber_int++;
+        m.bcl_startTime = m.time_int;
+        m.calculateAPD(1);
+
+        m.rrc_random_injection = m.rrc_random.next() % 100 + 1;
+        m.rrc_random_threshold = m.rrc_random.next() % 100 + 1;
+        if (m.rrc_random_threshold >= 50)
+          m.rrc_injectionAmplitude =
+              m.rrc_amplitude * (1 + (m.rrc_thresholdWindow / 100.0)) * 1e-9;
+        else
+          m.rrc_injectionAmplitude =
+              m.rrc_amplitude * (1 - (m.rrc_thresholdWindow / 100.0)) * 1e-9;
+      }
+
+      m.outputCurrent = 0;
+      if ((m.time_int - m.bcl_startTime) < m.stim_length_int)
+        m.outputCurrent += m.stim_amplitude * 1e-9;
+      if (m.beatNumber_int % m.rrc_beatNumber == 0 &&
+          m.rrc_random_injection <= m.rrc_chance) {
+        if ((m.time_int - m.bcl_startTime) > m.rrc_startTime &&
+            (m.time_int - m.bcl_startTime) < m.rrc_endTime)
+          m.outputCurrent += m.rrc_injectionAmplitude *
+              m.rrc_waveform[m.time_int - m.bcl_startTime - m.rrc_startTime -
+                             1];
+      }
+      m.outputCurrent += m.calculateDynamicClamp() * 1e-9;
+      m.output(0) = m.outputCurrent;
+
+      m.calculateAPD(2);
+      m.captureBeat();
+      break;
+
+    case Host::S1S2RESTITUTION:
+    case Host::DYNAMICRESTITUTION:
+      m.time += m.period;
+      m.time_int += 1;
+
+      if (m.time_int == 0 && m.rest_recordData && !m.recording)
+        m.dataRecord_start();
+
+      if (m.time_int - m.bcl_startTime >= m.bcl_int) {
+        if (!m.restitutionBeat()) {
+          m.beat_analyzer.endBeat(m.beat_apd);
+          if (m.recording)
+            m.dataRecord_stop();
+
+          m.rest_onFlag = false;
+          m.output(0) = 0;
+          m.protocolDone(true);
+          break;
+        }
+
+        m.beatNumber++;
+        m.beatNumber_int++;
+        m.bcl_startTime = m.time_int;
+        m.calculateAPD(1);
+      }
+
+      if ((m.time_int - m.bcl_startTime) < m.stim_length_int)
+        m.outputCurrent = m.stim_amplitude * 1e-9;
+      else
+        m.outputCurrent = 0;
+      m.outputCurrent += m.calculateDynamicClamp() * 1e-9;
+
+      m.output(0) = m.outputCurrent;
+
+      m.calculateAPD(2);
+      m.captureBeat();
+      break;
+
+    default:
+      break;
+  }
+}
+
+// Tick as the module runs it now
+void (*volatile modeTick)(Host &);
+
+__attribute__((noinline)) void pointerTick(Host &m) {
+  modeTick(m);
+}
+
+// Action potential sampled at 10 kHz, repeated every beat
+std::vector<double> actionPotential(int ticks) {
+  std::vector<double> v(ticks);
+  for (int i = 0; i < ticks; i++) {
+    double t = i * 0.1;
+    if (t < 2)
+      v[i] = -85 + t * 62.5;
+    else if (t < 200)
+      v[i] = 40 - 30 * (t - 2) / 198;
+    else if (t < 260)
+      v[i] = 10 - 95 * (t - 200) / 60;
+    else
+      v[i] = -85;
+  }
+  return v;
+}
+
+struct Run {
+  double nsPerTick;
+  double checksum;
+};
+
+Run run(Host::execute_mode_t mode, bool useSwitch, long ticks,
+        const std::vector<double> &ap) {
+  Host host(mode);
+  double checksum = 0;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (long i = 0; i < ticks; i++) {
+    host.voltage = ap[(host.time_int + 1 - host.bcl_startTime) % ap.size()];
+    if (useSwitch)
+      switchTick(host);
+    else
+      pointerTick(host);
+    checksum += host.output0 + host.apd;
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  Run result = {elapsed.count() / ticks, checksum};
+  return result;
+}
+}
+
+int main(int argc, char *argv[]) {
+  long ticks = argc > 1 ? std::atol(argv[1]) : 20000000;
+  std::vector<double> ap = actionPotential(5000);
+
+  struct {
+    const char *name;
+    Host::execute_mode_t mode;
+    void (*tick)(Host &);
+  } modes[] = {
+    {"pace", Host::PACE, &RRC::PaceMode::tick<Host>},
+    {"rrc_threshold", Host::RRCTHRESHOLD, &RRC::RRCThresholdMode::tick<Host>},
+    {"rrc_protocol", Host::RRCPROTOCOL, &RRC::RRCProtocolMode::tick<Host>},
+    {"restitution", Host::DYNAMICRESTITUTION,
+     &RRC::RestitutionMode::tick<Host>},
+  };
+
+  std::printf("%-14s %12s %12s %8s\n", "mode", "switch ns", "modes ns",
+              "outputs");
+  bool same = true;
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+    modeTick = modes[i].tick;
+    // Best of alternating runs, to reduce the effect of frequency scaling
+    Run bestSwitch = {HUGE_VAL, 0}, bestModes = {HUGE_VAL, 0};
+    for (int repeat = 0; repeat < 5; repeat++) {
+      Run s = run(modes[i].mode, true, ticks, ap);
+      Run p = run(modes[i].mode, false, ticks, ap);
+      if (s.nsPerTick < bestSwitch.nsPerTick)
+        bestSwitch = s;
+      if (p.nsPerTick < bestModes.nsPerTick)
+        bestModes = p;
+    }
+    bool match = bestSwitch.checksum == bestModes.checksum;
+    same = same && match;
+    std::printf("%-14s %12.2f %12.2f %8s\n", modes[i].name,
+                bestSwitch.nsPerTick, bestModes.nsPerTick,
+                match ? "same" : "DIFFER");
+  }
+  return same ? 0 : 1;
+}
@@ -0,0 +1,298 @@
+// Readers of recorded sessions shared by the offline tools
+//
+// A session is an HDF5 file written by the RTXI data recorder, a raw trace
+// file (.rrct) or a compressed trace file (.rrcz). readSession() streams the
+// time, voltage and beat number of every sample to a sink with two methods:
+//   void trial(int trialNumber, double period);
+//   void sample(double time, double voltage, double beat);
+// trial() is called before the first sample of each trial.
+
+#ifndef RRC_TOOLS_RECORDING_H
+#define RRC_TOOLS_RECORDING_H
+
+#include "RRC_Trace.h"
+#include "RRC_CompressedTrace.h"
+
+#include <hdf5.h>
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace RRCTools {
+struct Channels {
+  Channels() : voltage("Voltage (mV)"), beat("Beat Number"),
+               time("Time (ms)") {}
+  std::string voltage; // Channel name suffix of membrane voltage
+  std::string beat; // Channel name suffix of beat number
+  std::string time; // Channel name suffix of time
+};
+
+inline std::mutex &logMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+// HDF5 is usually built without thread safety, so library calls are
+// serialized while the tools work concurrently
+inline std::mutex &hdf5Mutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+inline void logError(const std::string &fileName, const std::string &message) {
+  std::lock_guard<std::mutex> lock(logMutex());
+  std::cerr << fileName << ": " << message << std::endl;
+}
+
+inline bool endsWith(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() &&
+      s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Reads a string dataset, fixed or variable length
+inline bool readString(hid_t location, const std::string &name,
+                       std::string &value) {
+  hid_t dataset = H5Dopen2(location, name.c_str(), H5P_DEFAULT);
+  if (dataset < 0)
+    return false;
+
+  hid_t type = H5Dget_type(dataset);
+  bool ok = false;
+  if (H5Tget_class(type) == H5T_STRING) {
+    if (H5Tis_variable_str(type) > 0) {
+      char *buffer = NULL;
+      hid_t memType = H5Tcopy(H5T_C_S1);
+      H5Tset_size(memType, H5T_VARIABLE);
+      if (H5Dread(dataset, memType, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+                  &buffer) >= 0 && buffer) {
+        value = buffer;
+        ok = true;
+      }
+      if (buffer)
+        H5free_memory(buffer);
+      H5Tclose(memType);
+    }
+    else {
+      std::vector<char> buffer(H5Tget_size(type) + 1, 0);
+      hid_t memType = H5Tcopy(H5T_C_S1);
+      H5Tset_size(memType, buffer.size());
+      if (H5Dread(dataset, memType, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+                  &buffer[0]) >= 0) {
+        value = &buffer[0];
+        ok = true;
+      }
+      H5Tclose(memType);
+    }
+  }
+  H5Tclose(type);
+  H5Dclose(dataset);
+  return ok;
+}
+
+// Channel index (0-based) whose recorded name ends with suffix, -1 if none
+inline int findChannel(hid_t syncData, const std::string &suffix) {
+  for (int i = 1; ; i++) {
+    std::ostringstream name;
+    name << "Channel " << i << " Name";
+    if (H5Lexists(syncData, name.str().c_str(), H5P_DEFAULT) <= 0)
+      return -1;
+
+    std::string channelName;
+    if (readString(syncData, name.str(), channelName) &&
+        endsWith(channelName, suffix))
+      return i - 1;
+  }
+}
+
+// Streams one trial of an HDF5 recording to sink
+template <typename Sink>
+bool readTrial(hid_t trial, int trialNumber, const Channels &channels,
+               const std::string &fileName, Sink &sink) {
+  std::unique_lock<std::mutex> lock(hdf5Mutex());
+  hid_t syncData = H5Gopen2(trial, "Synchronous Data", H5P_DEFAULT);
+  if (syncData < 0) {
+    logError(fileName, "missing Synchronous Data group");
+    return false;
+  }
+
+  int voltageChannel = findChannel(syncData, channels.voltage);
+  int beatChannel = findChannel(syncData, channels.beat);
+  int timeChannel = findChannel(syncData, channels.time);
+  if (voltageChannel < 0 || beatChannel < 0) {
+    logError(fileName, "voltage or beat number channel not recorded");
+    H5Gclose(syncData);
+    return false;
+  }
+
+  // Period is used for time if the time state was not recorded
+  double period = 0;
+  hid_t periodSet = H5Dopen2(trial, "Period (ns)", H5P_DEFAULT);
+  if (periodSet >= 0) {
+    unsigned long long periodNs = 0;
+    H5Dread(periodSet, H5T_NATIVE_ULLONG, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+            &periodNs);
+    period = periodNs * 1e-6;
+    H5Dclose(periodSet);
+  }
+
+  hid_t data = H5Dopen2(syncData, "Channel Data", H5P_DEFAULT);
+  if (data < 0) {
+    logError(fileName, "missing Channel Data");
+    H5Gclose(syncData);
+    return false;
+  }
+
+  // Data recorder writes one array of all channels per sample
+  hid_t type = H5Dget_type(data);
+  hid_t space = H5Dget_space(data);
+  hsize_t dims[2] = {0, 1};
+  int rank = H5Sget_simple_extent_dims(space, dims, NULL);
+  hsize_t channelCount = dims[1];
+  if (H5Tget_class(type) == H5T_ARRAY) {
+    hsize_t arrayDims[1];
+    H5Tget_array_dims2(type, arrayDims);
+    channelCount = arrayDims[0];
+  }
+  else if (rank != 2) {
+    logError(fileName, "unexpected Channel Data layout");
+    H5Tclose(type);
+    H5Sclose(space);
+    H5Dclose(data);
+    H5Gclose(syncData);
+    return false;
+  }
+  hid_t memType = H5Tget_class(type) == H5T_ARRAY ?
+      H5Tarray_create2(H5T_NATIVE_DOUBLE, 1, &channelCount) :
+      H5Tcopy(H5T_NATIVE_DOUBLE);
+
+  sink.trial(trialNumber, period);
+  const hsize_t chunk = 65536;
+  std::vector<double> buffer(chunk * channelCount);
+  hsize_t samples = dims[0];
+  bool ok = true;
+
+  for (hsize_t first = 0; first < samples && ok; first += chunk) {
+    hsize_t count[2] = {std::min(chunk, samples - first), channelCount};
+    hsize_t start[2] = {first, 0};
+    if (!lock.owns_lock())
+      lock.lock();
+    H5Sselect_hyperslab(space, H5S_SELECT_SET, start, NULL, count, NULL);
+    hid_t memSpace = H5Screate_simple(rank == 2 ? 2 : 1, count, NULL);
+    if (H5Dread(data, memType, memSpace, space, H5P_DEFAULT,
+                &buffer[0]) < 0) {
+      logError(fileName, "unable to read Channel Data");
+      ok = false;
+    }
+    H5Sclose(memSpace);
+    lock.unlock();
+
+    for (hsize_t i = 0; i < count[0] && ok; i++) {
+      const double *row = &buffer[i * channelCount];
+      sink.sample(timeChannel >= 0 ? row[timeChannel] : (first + i) * period,
+                  row[voltageChannel], row[beatChannel]);
+    }
+  }
+
+  if (!lock.owns_lock())
+    lock.lock();
+  H5Tclose(memType);
+  H5Tclose(type);
+  H5Sclose(space);
+  H5Dclose(data);
+  H5Gclose(syncData);
+  return ok;
+}
+
+// Streams every trial of a recorded HDF5 file
+template <typename Sink>
+bool readRecording(const std::string &fileName, const Channels &channels,
+                   Sink &sink) {
+  std::unique_lock<std::mutex> lock(hdf5Mutex());
+  hid_t file = H5Fopen(fileName.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  if (file < 0) {
+    logError(fileName, "unable to open file");
+    return false;
+  }
+  lock.unlock();
+
+  bool ok = true;
+  for (int i = 1; ok; i++) {
+    std::ostringstream name;
+    name << "Trial" << i;
+    lock.lock();
+    if (H5Lexists(file, name.str().c_str(), H5P_DEFAULT) <= 0) {
+      lock.unlock();
+      break;
+    }
+    hid_t trial = H5Gopen2(file, name.str().c_str(), H5P_DEFAULT);
+    lock.unlock();
+
+    ok = readTrial(trial, i, channels, fileName, sink);
+
+    lock.lock();
+    H5Gclose(trial);
+    lock.unlock();
+  }
+
+  lock.lock();
+  H5Fclose(file);
+  return ok;
+}
+
+// Raw traces are memory mapped and read without HDF5, as trial 1
+template <typename Sink>
+bool readTrace(const std::string &fileName, Sink &sink) {
+  RRC::TraceReader trace;
+  if (!trace.open(fileName)) {
+    logError(fileName, "not a raw trace file");
+    return false;
+  }
+
+  sink.trial(1, trace.period());
+  for (const RRC::TraceRecord *record = trace.begin(); record != trace.end();
+       record++)
+    sink.sample(record->time, record->voltage, record->beatNumber);
+  return true;
+}
+
+// Compressed traces are decoded one block at a time, as trial 1
+template <typename Sink>
+bool readCompressedTrace(const std::string &fileName, Sink &sink) {
+  RRC::CompressedTraceReader trace;
+  if (!trace.open(fileName)) {
+    logError(fileName, "not a compressed trace file");
+    return false;
+  }
+
+  sink.trial(1, trace.period());
+  std::vector<RRC::TraceRecord> records;
+  for (size_t i = 0; i < trace.blocks(); i++) {
+    records.clear();
+    if (!trace.readBlock(i, records)) {
+      logError(fileName, "unable to read block");
+      return false;
+    }
+    for (size_t j = 0; j < records.size(); j++)
+      sink.sample(records[j].time, records[j].voltage,
+                  records[j].beatNumber);
+  }
+  return true;
+}
+
+// Chooses the reader from the file name
+template <typename Sink>
+bool readSession(const std::string &fileName, const Channels &channels,
+                 Sink &sink) {
+  if (endsWith(fileName, ".rrct"))
+    return readTrace(fileName, sink);
+  if (endsWith(fileName, ".rrcz"))
+    return readCompressedTrace(fileName, sink);
+  return readRecording(fileName, channels, sink);
+}
+}; // Namespace RRCTools
+
+#endif // RRC_TOOLS_RECORDING_H
@@ -0,0 +1,262 @@
+// Offline replay of recorded sessions through the module's APD detector
+//
+// Streams the recorded voltage of each trial through RRC::APDDetector, the
+// same code calculateAPD() runs online, and writes one APD table per file.
+// Files are processed in parallel, one file per worker thread.
+//
+// Raw trace files (.rrct) written by the module are memory mapped instead and
+// compressed trace files (.rrcz) are decoded block by block, see
+// rrc_recording.h.
+//
+// With --compare, two files of the same session are compared sample by
+// sample instead, such as the raw and compressed traces of one run. Time and
+// beat number must be equal and voltage within the tolerance.
+//
+// Usage: rrc_replay [options] file.h5|file.rrct|file.rrcz ...
+//        rrc_replay --compare [--tolerance MV] file file
+//   -j N            Number of worker threads (default: number of cores)
+//   -o DIR          Output directory (default: next to each input file)
+//   --repol N       APD repolarization percentage (default: 90)
+//   --window N      Stimulus window (ms) (default: 4)
+//   --hold MS       Time peak must hold (ms) (default: 5)
+//   --upstroke MV   Upstroke threshold (mV) (default: -40)
+//   --min MS        Minimum APD, shorter APs count as 0 (ms) (default: 0)
+//   --decimate N    Samples averaged per detector step (default: 1)
+//   --voltage NAME  Channel name suffix of membrane voltage
+//                   (default: "Voltage (mV)")
+//   --beat NAME     Channel name suffix of beat number (default: "Beat Number")
+//   --time NAME     Channel name suffix of time (default: "Time (ms)")
+//   --compare       Compare two files instead of writing APD tables
+//   --tolerance MV  Largest voltage difference of --compare, half the
+//                   voltage resolution of a compressed trace (default: 0.005)
+
+#include "RRC_APD.h"
+#include "RRC_Decimator.h"
+#include "rrc_recording.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+struct Options {
+  Options() : threads(0), repolPercent(90), stimWindow(4), peakHold(5),
+              upstrokeThreshold(-40), minApd(0), decimation(1),
+              compare(false), tolerance(0.005) {}
+  unsigned threads;
+  std::string outputDir;
+  int repolPercent;
+  int stimWindow;
+  double peakHold;
+  double upstrokeThreshold;
+  double minApd;
+  int decimation;
+  bool compare;
+  double tolerance;
+  RRCTools::Channels channels;
+};
+
+// Feeds samples of each trial to the detector in the same order as
+// execute(), beat advance first and then the second APD step, and writes each
+// APD found
+class Replay {
+ public:
+  Replay(const Options &options, std::ostream &out) :
+      trialNumber(0), period(0), samples(0), beatNumber(0), out(out) {
+    detector.repolPercent = options.repolPercent;
+    detector.stimWindow = options.stimWindow;
+    detector.peakHold = options.peakHold;
+    detector.upstrokeThreshold = options.upstrokeThreshold;
+    detector.minApd = options.minApd;
+    decimator.factor = options.decimation;
+  }
+
+  void trial(int trialNumber, double period) {
+    this->trialNumber = trialNumber;
+    this->period = period;
+    samples = 0;
+  }
+
+  void sample(double time, double voltage, double beat) {
+    if (samples++ == 0) {
+      detector.start(time - period, voltage);
+      decimator.reset();
+      beatNumber = beat;
+    }
+    else if (beat != beatNumber) {
+      beatNumber = beat;
+      detector.beat(time, voltage);
+      decimator.reset();
+    }
+
+    if (decimator.push(time, voltage) &&
+        detector.step(decimator.time, decimator.voltage))
+      out << trialNumber << ',' << beatNumber << ',' << detector.stimTime
+          << ',' << detector.apd << ',' << detector.vmRest << ','
+          << detector.peakVoltage << '\n';
+  }
+
+ private:
+  RRC::APDDetector detector;
+  RRC::Decimator decimator;
+  int trialNumber;
+  double period;
+  unsigned long long samples;
+  double beatNumber;
+  std::ostream &out;
+};
+
+// Every sample of a file, for --compare
+struct Samples {
+  void trial(int, double) {}
+
+  void sample(double time, double voltage, double beat) {
+    times.push_back(time);
+    voltages.push_back(voltage);
+    beats.push_back(beat);
+  }
+
+  std::vector<double> times;
+  std::vector<double> voltages;
+  std::vector<double> beats;
+};
+
+// Returns true if both files hold the same samples
+bool compareFiles(const std::string &first, const std::string &second,
+                  const Options &options) {
+  Samples a, b;
+  if (!RRCTools::readSession(first, options.channels, a) ||
+      !RRCTools::readSession(second, options.channels, b))
+    return false;
+
+  if (a.times.size() != b.times.size()) {
+    std::cerr << first << ", " << second << ": " << a.times.size()
+              << " and " << b.times.size() << " samples" << std::endl;
+    return false;
+  }
+  for (size_t i = 0; i < a.times.size(); i++)
+    if (a.times[i] != b.times[i] || a.beats[i] != b.beats[i] ||
+        !(std::fabs(a.voltages[i] - b.voltages[i]) <= options.tolerance)) {
+      std::cerr.precision(17);
+      std::cerr << first << ", " << second << ": sample " << i
+                << " differs, time " << a.times[i] << " and " << b.times[i]
+                << ", beat " << a.beats[i] << " and " << b.beats[i]
+                << ", voltage " << a.voltages[i] << " and " << b.voltages[i]
+                << std::endl;
+      return false;
+    }
+  std::cout << first << ", " << second << ": " << a.times.size()
+            << " samples match" << std::endl;
+  return true;
+}
+
+std::string outputName(const std::string &fileName, const Options &options) {
+  std::string base = fileName;
+  size_t dot = base.rfind('.');
+  if (dot != std::string::npos && base.find('/', dot) == std::string::npos)
+    base.erase(dot);
+  if (!options.outputDir.empty()) {
+    size_t slash = base.rfind('/');
+    if (slash != std::string::npos)
+      base.erase(0, slash + 1);
+    base = options.outputDir + "/" + base;
+  }
+  return base + ".apd.csv";
+}
+
+bool replayFile(const std::string &fileName, const Options &options) {
+  std::ofstream out(outputName(fileName, options).c_str());
+  if (!out.is_open()) {
+    RRCTools::logError(fileName, "unable to open output file");
+    return false;
+  }
+  out.precision(17);
+  out << "trial,beat,stimulus_time_ms,apd_ms,vm_rest_mv,peak_mv\n";
+
+  Replay replay(options, out);
+  return RRCTools::readSession(fileName, options.channels, replay);
+}
+
+void usage() {
+  std::cerr << "Usage: rrc_replay [-j threads] [-o dir] [--repol N] "
+            << "[--window N] [--hold MS] [--upstroke MV] [--min MS] "
+            << "[--decimate N] "
+            << "[--voltage NAME] [--beat NAME] [--time NAME] "
+            << "file.h5|file.rrct|file.rrcz ..." << std::endl
+            << "       rrc_replay --compare [--tolerance MV] file file"
+            << std::endl;
+}
+}
+
+int main(int argc, char *argv[]) {
+  Options options;
+  std::vector<std::string> files;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "-j" && hasValue)
+      options.threads = std::atoi(argv[++i]);
+    else if (arg == "-o" && hasValue)
+      options.outputDir = argv[++i];
+    else if (arg == "--repol" && hasValue)
+      options.repolPercent = std::atoi(argv[++i]);
+    else if (arg == "--window" && hasValue)
+      options.stimWindow = std::atoi(argv[++i]);
+    else if (arg == "--hold" && hasValue)
+      options.peakHold = std::atof(argv[++i]);
+    else if (arg == "--upstroke" && hasValue)
+      options.upstrokeThreshold = std::atof(argv[++i]);
+    else if (arg == "--min" && hasValue)
+      options.minApd = std::atof(argv[++i]);
+    else if (arg == "--decimate" && hasValue)
+      options.decimation = std::max(1, std::atoi(argv[++i]));
+    else if (arg == "--voltage" && hasValue)
+      options.channels.voltage = argv[++i];
+    else if (arg == "--beat" && hasValue)
+      options.channels.beat = argv[++i];
+    else if (arg == "--time" && hasValue)
+      options.channels.time = argv[++i];
+    else if (arg == "--compare")
+      options.compare = true;
+    else if (arg == "--tolerance" && hasValue)
+      options.tolerance = std::atof(argv[++i]);
+    else if (!arg.empty() && arg[0] == '-') {
+      usage();
+      return 1;
+    }
+    else
+      files.push_back(arg);
+  }
+  if (files.empty() || (options.compare && files.size() != 2)) {
+    usage();
+    return 1;
+  }
+  if (options.compare)
+    return compareFiles(files[0], files[1], options) ? 0 : 1;
+
+  if (options.threads == 0)
+    options.threads = std::max(1u, std::thread::hardware_concurrency());
+  options.threads = std::min<unsigned>(options.threads, files.size());
+
+  // Each worker replays whole files, taking the next one when done
+  std::atomic<size_t> next(0);
+  std::atomic<int> failures(0);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < options.threads; t++)
+    workers.push_back(std::thread([&]() {
+      for (size_t i = next++; i < files.size(); i = next++)
+        if (!replayFile(files[i], options))
+          failures++;
+    }));
+  for (size_t t = 0; t < workers.size(); t++)
+    workers[t].join();
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,660 @@
+// Simulated experiments run end to end through the module's protocol modes
+//
+// Each scenario is a modeled cell on a modeled amplifier, run through the
+// whole experiment a sequence would run: stimulus threshold, latency test,
+// capacitance test, pacing, RRC threshold search, RRC protocol, dynamic and
+// S1-S2 restitution. Results are passed on from one protocol to the next as
+// the module does. Modes are the tick() of RRC_Modes.h on a stand-in for the
+// module, with the module's restart, APD detection, restitution steps and
+// dynamic clamp of RRC_Protocol.h, analysis decimation, and latency and
+// capacitance probes.
+//
+// The cell is a Mitchell-Schaeffer model scaled to mV, charged by the output
+// current through its membrane capacitance. Its leak can grow while it runs,
+// so excitability and APD run down as in a failing cell. Output reaches the
+// cell after a delay of whole ticks, and measured voltage can carry noise.
+// Noise and the RRC protocol draws come from RRC::Random with fixed seeds, so
+// a scenario gives the same results on every run.
+//
+// Per-beat APDs and the results of each protocol (thresholds, latency, Cm,
+// restitution points) are compared with a golden file, exactly, and the wall
+// time and simulated beats per second of each scenario are reported. With -u
+// the golden file is written from this run instead.
+//
+// With -t, each tick of the first run of a scenario is also written to a raw
+// and a compressed trace, <dir>/<scenario>.rrct and .rrcz, as the module
+// records a sequence. Time restarts with each protocol and a record in
+// 100000 is left out of both, as if dropped, so rrc_replay --compare checks
+// the compressed format across both kinds of time jumps.
+//
+// Usage: rrc_scenarios [-u] [-r repeats] [-t dir] [golden file]
+//   -u           Write golden results instead of comparing
+//   -r N         Runs of each scenario, fastest is reported (default: 3)
+//   -t DIR       Write traces of each scenario to DIR
+//   golden file  Default: rrc_scenarios.golden
+
+#include "RRC_APD.h"
+#include "RRC_Capacitance.h"
+#include "RRC_CompressedTrace.h"
+#include "RRC_Decimator.h"
+#include "RRC_Latency.h"
+#include "RRC_Modes.h"
+#include "RRC_Protocol.h"
+#include "RRC_Random.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+struct Scenario {
+  const char *name;
+  double period; // RTXI period (ms)
+  double bcl; // Pacing BCL (ms)
+  int decimation; // Analysis decimation
+  // Cell
+  double cm; // pF
+  double tauIn; // Mitchell-Schaeffer time constants (ms)
+  double tauOut;
+  double tauOpen;
+  double tauClose;
+  double vGate; // Gate threshold, fraction of AP amplitude
+  double rundown; // Growth of leak per second of simulated time (1/s)
+  // Amplifier
+  int delay; // Ticks from output to cell
+  double noise; // SD of measured voltage (mV)
+  // Dynamic clamp
+  int dcModel; // Model of the module, 0 off, 1 IKr, 2 IK1
+  double dcConductance; // nS
+};
+
+const Scenario scenarios[] = {
+  // Name, period, BCL, decimation, Cm, tauIn, tauOut, tauOpen, tauClose,
+  // vGate, rundown, delay, noise, DC model, DC conductance
+  {"normal", 0.1, 1000, 1, 100, 0.3, 6, 120, 150, 0.13, 0, 1, 0, 0, 0},
+  {"fast_pacing", 0.05, 350, 1, 100, 0.3, 6, 120, 150, 0.13, 0, 1, 0, 0, 0},
+  {"noisy", 0.1, 1000, 4, 100, 0.3, 6, 120, 150, 0.13, 0, 3, 1.5, 0, 0},
+  {"failing_cell", 0.1, 1000, 1, 100, 0.3, 6, 120, 150, 0.13, 0.02, 1, 0.2,
+   0, 0},
+  {"dynamic_clamp", 0.1, 1000, 1, 100, 0.3, 6, 120, 150, 0.13, 0, 1, 0, 1,
+   30},
+};
+
+// Mitchell-Schaeffer cell, v is the fraction of AP amplitude above rest
+class Cell {
+ public:
+  explicit Cell(const Scenario &s) :
+      s(s), v(0), h(1), elapsed(0), pending(s.delay, 0.0), next(0) {
+    random.seed(12345);
+  }
+
+  // Voltage measured at the start of the tick (mV)
+  double measure() {
+    double measured = vRest + amplitude * v;
+    if (s.noise > 0) {
+      // Sum of 4 uniform draws, scaled to unit SD
+      double sum = 0;
+      for (int i = 0; i < 4; i++)
+        sum += random.next() / 4294967296.0;
+      measured += (sum - 2) * std::sqrt(3.0) * s.noise;
+    }
+    return measured;
+  }
+
+  // Advances the cell by one tick, output (A) reaches it after the delay
+  void step(double output) {
+    double current = pending[next];
+    pending[next] = output;
+    next = (next + 1) % pending.size();
+
+    double dt = s.period;
+    double leak = 1 + s.rundown * elapsed / 1000;
+    double inward = v > 0 ? h * v * v * (1 - v) / s.tauIn : 0;
+    // pA / pF = mV / ms, as a fraction of AP amplitude
+    double stimulus = current * 1e12 / s.cm / amplitude;
+    v += dt * (inward - leak * v / s.tauOut + stimulus);
+    if (v < s.vGate)
+      h += dt * (1 - h) / s.tauOpen;
+    else
+      h -= dt * h / s.tauClose;
+    elapsed += dt;
+  }
+
+ private:
+  static constexpr double vRest = -85; // mV
+  static constexpr double amplitude = 125; // mV
+
+  const Scenario &s;
+  double v;
+  double h; // Inward current gate
+  double elapsed; // ms
+  std::vector<double> pending; // Outputs on their way to the cell (A)
+  size_t next;
+  RRC::Random random;
+};
+
+// Results of a scenario as scenario,protocol,item,value lines
+struct Results {
+  void add(const std::string &protocol, const std::string &item,
+           double value) {
+    char line[256];
+    std::snprintf(line, sizeof(line), "%s,%s,%s,%.17g", scenario.c_str(),
+                  protocol.c_str(), item.c_str(), value);
+    lines.push_back(line);
+  }
+
+  void add(const std::string &protocol, const std::string &item, int index,
+           double value) {
+    add(protocol, item + "." + std::to_string(index), value);
+  }
+
+  std::string scenario;
+  std::vector<std::string> lines;
+};
+
+// Members of RRC::Module used by the modes, with the module's defaults
+struct Host {
+  enum execute_mode_t {IDLE, STIMTHRESHOLD, PACE, RRCTHRESHOLD, RRCPROTOCOL,
+                       S1S2RESTITUTION, DYNAMICRESTITUTION, LATENCYTEST,
+                       CAPACITANCE};
+  enum rest_phase_t {REST_PACING, REST_COUPLING, REST_TEST};
+  enum dc_model_t {DC_OFF, DC_IKR, DC_IK1};
+
+  // Per-beat APDs of the running protocol
+  struct Analyzer {
+    void endBeat(double apd) {
+      results->add(protocol, "apd", ++beats, apd);
+    }
+
+    Results *results;
+    std::string protocol;
+    int beats;
+  };
+
+  Host(const Scenario &s, Results &results) :
+      time(0), voltage(0), beatNumber(0), apd(0), period(s.period),
+      bcl(s.bcl), cm(s.cm), stim_amplitude(4), stim_current(4e-9),
+      amplitude_scale(1e-9), stim_length_int(1 / s.period), outputCurrent(0),
+      recording(false), execute_mode(IDLE), execute_tick(0),
+      stim_recordData(false), stim_onFlag(false), stim_maxLevel(0),
+      pace_recordData(false), pace_endBeat(0), pace_onFlag(false),
+      thresh_recordData(false), thresh_beatNumber(3), thresh_apdCutoff(20),
+      thresh_startAmplitude(0), thresh_ampIncrement(0.01),
+      thresh_maxAmplitude(0), thresh_onFlag(false),
+      rrcProtocol_onFlag(false), rrcProtocol_recordData(false),
+      rrc_amplitude(0), rrc_delay(5), rrc_thresholdWindow(10),
+      rrc_beatNumber(3), rrc_chance(50), rrc_endBeatNumber(100),
+      rest_onFlag(false), rest_recordData(false), rest_step(50),
+      rest_minBcl(200), rest_tolerance(2), rest_convergedBeats(5),
+      rest_maxBeats(50), latency_amplitude(-0.5), latency_onFlag(false),
+      cm_amplitude(-0.05), cm_onFlag(false),
+      dc_model(static_cast<dc_model_t>(s.dcModel)),
+      dc_conductance(s.dcConductance), dc_ek(-85), output0(0), success(false),
+      cell(s), ticks(0), results(results) {
+    apd_detector.minApd = 50;
+    analysis_decimator.factor = s.decimation;
+    beat_analyzer.results = &results;
+    cm_probe.allocate(period);
+  }
+
+  double &output(int) { return output0; }
+  void dataRecord_start() { recording = true; }
+  void dataRecord_stop() { recording = false; }
+
+  void protocolDone(bool success) {
+    this->success = success;
+    setMode(IDLE);
+  }
+
+  void setMode(execute_mode_t mode) {
+    static void (*const modeTicks[])(Host &) = {
+      &RRC::IdleMode::tick<Host>,
+      &RRC::StimThresholdMode::tick<Host>,
+      &RRC::PaceMode::tick<Host>,
+      &RRC::RRCThresholdMode::tick<Host>,
+      &RRC::RRCProtocolMode::tick<Host>,
+      &RRC::RestitutionMode::tick<Host>, // S1S2RESTITUTION
+      &RRC::RestitutionMode::tick<Host>, // DYNAMICRESTITUTION
+      &RRC::LatencyMode::tick<Host>,
+      &RRC::CapacitanceMode::tick<Host>,
+    };
+    execute_tick = modeTicks[mode];
+    execute_mode = mode;
+  }
+
+  void restart() {
+    RRC::Protocol::restart(*this);
+    compileRRCWaveform();
+  }
+
+  // Square RRC waveform from rrc_delay after the stimulus to the next one
+  void compileRRCWaveform() {
+    rrc_startTime = stim_length_int + (rrc_delay / period);
+    rrc_endTime = bcl_int;
+    rrc_waveform.assign(std::max(0, rrc_endTime - rrc_startTime - 1), 1.0);
+  }
+
+  void calculateAPD(int step) { RRC::Protocol::calculateAPD(*this, step); }
+
+  void captureBeat() {
+    // First stimulus of a protocol ends no beat
+    if (time_int == bcl_startTime && time_int > 0) {
+      beat_analyzer.endBeat(beat_apd);
+      beat_apd = -1;
+    }
+  }
+
+  bool restitutionBeat() { return RRC::Protocol::restitutionBeat(*this); }
+
+  void startRestitutionStep(double cycle) {
+    RRC::Protocol::startRestitutionStep(*this, cycle);
+  }
+
+  double calculateDynamicClamp() {
+    return RRC::Protocol::calculateDynamicClamp(*this);
+  }
+
+  void addRestitutionPoint(double di, double apd) {
+    int point = ++rest_points;
+    results.add(beat_analyzer.protocol, "cycle", point, rest_cycle);
+    results.add(beat_analyzer.protocol, "di", point, di);
+    results.add(beat_analyzer.protocol, "point_apd", point, apd);
+  }
+
+  // One RTXI period: input, mode tick, output
+  void tick() {
+    voltage = cell.measure();
+    execute_tick(*this);
+    cell.step(output0);
+    ticks++;
+    if (!traces.empty() && ticks % 100000 != 0)
+      trace();
+  }
+
+  // Writes the tick to each trace as RRC::Module::execute(). The writer is
+  // waited for instead of dropping, so every trace gets the same records
+  void trace() {
+    RRC::TraceRecord record = {time, voltage, output0,
+                               static_cast<int32_t>(beatNumber),
+                               execute_mode};
+    for (size_t i = 0; i < traces.size(); i++)
+      for (;;) {
+        unsigned long dropped = traces[i]->dropped();
+        traces[i]->push(record);
+        if (traces[i]->dropped() == dropped)
+          break;
+        std::this_thread::yield();
+      }
+  }
+
+  // Runs the module idle for a time (ms)
+  void idle(double duration) {
+    setMode(IDLE);
+    output0 = 0;
+    for (int i = 0; i < duration / period; i++)
+      tick();
+  }
+
+  // Starts a protocol as RRC::Module::startMode() and runs it until it ends
+  // or for at most limit (ms). Returns true if it ended with success
+  bool run(const char *protocol, execute_mode_t mode, double limit) {
+    beat_analyzer.protocol = protocol;
+    beat_analyzer.beats = 0;
+    rest_points = 0;
+    success = false;
+    restart();
+    setMode(mode);
+    switch (mode) {
+      case STIMTHRESHOLD:
+        stim_onFlag = true;
+        stim_vmRest = voltage;
+        stim_peakVoltage = stim_vmRest;
+        stim_stimulusLevel = 2.0;
+        stim_backToBaseline = false;
+        stim_responseDuration = 0;
+        stim_responseTime = 0;
+        stim_startTime = 0;
+        break;
+
+      case PACE:
+        pace_onFlag = true;
+        break;
+
+      case RRCTHRESHOLD:
+        thresh_onFlag = true;
+        thresh_previousAPD = -1;
+        thresh_rrcThreshFound = false;
+        thresh_rrcAmplitude = thresh_startAmplitude;
+        rrc_injectionAmplitude = thresh_rrcAmplitude * amplitude_scale;
+        break;
+
+      case RRCPROTOCOL:
+        rrcProtocol_onFlag = true;
+        rrc_random.seed(1);
+        break;
+
+      case LATENCYTEST:
+        latency_onFlag = true;
+        latency_probe.start(period);
+        break;
+
+      case CAPACITANCE:
+        cm_onFlag = true;
+        cm_probe.start();
+        break;
+
+      case S1S2RESTITUTION:
+        rest_onFlag = true;
+        rest_s1APD = -1;
+        startRestitutionStep(bcl - rest_step);
+        break;
+
+      case DYNAMICRESTITUTION:
+        rest_onFlag = true;
+        rest_s1APD = -1;
+        startRestitutionStep(bcl);
+        break;
+
+      default:
+        break;
+    }
+
+    long maxTicks = limit / period;
+    for (long i = 0; i < maxTicks && execute_mode != IDLE; i++)
+      tick();
+    bool ended = execute_mode == IDLE;
+    results.add(protocol, "ended", ended);
+    results.add(protocol, "success", success);
+    results.add(protocol, "beats", beat_analyzer.beats);
+    if (!ended)
+      protocolDone(false);
+    return ended && success;
+  }
+
+  double time;
+  double voltage;
+  double beatNumber;
+  double apd;
+  double period;
+  double bcl;
+  double cm;
+  double stim_amplitude;
+  double stim_current;
+  double amplitude_scale;
+  int time_int;
+  int bcl_int;
+  int bcl_startTime;
+  int stim_length_int;
+  int beatNumber_int;
+  double outputCurrent;
+  bool recording;
+  execute_mode_t execute_mode;
+  void (*execute_tick)(Host &);
+  // Stimulus threshold
+  bool stim_recordData;
+  bool stim_onFlag;
+  bool stim_backToBaseline;
+  double stim_maxLevel;
+  double stim_stimulusLevel;
+  double stim_peakVoltage;
+  double stim_vmRest;
+  double stim_responseDuration;
+  double stim_responseTime;
+  double stim_startTime;
+  // Pacing
+  bool pace_recordData;
+  int pace_endBeat;
+  bool pace_onFlag;
+  // RRC threshold
+  bool thresh_recordData;
+  int thresh_beatNumber;
+  int thresh_apdCutoff;
+  bool thresh_rrcThreshFound;
+  double thresh_previousAPD;
+  double thresh_startAmplitude;
+  double thresh_rrcAmplitude;
+  double thresh_ampIncrement;
+  double thresh_maxAmplitude;
+  bool thresh_onFlag;
+  // RRC protocol
+  bool rrcProtocol_onFlag;
+  bool rrcProtocol_recordData;
+  double rrc_amplitude;
+  double rrc_delay;
+  int rrc_thresholdWindow;
+  int rrc_beatNumber;
+  int rrc_chance;
+  int rrc_endBeatNumber;
+  int rrc_startTime;
+  int rrc_endTime;
+  int rrc_random_injection;
+  int rrc_random_threshold;
+  RRC::Random rrc_random;
+  double rrc_injectionAmplitude;
+  std::vector<double> rrc_waveform;
+  // Restitution
+  bool rest_onFlag;
+  bool rest_recordData;
+  rest_phase_t rest_phase;
+  double rest_cycle;
+  double rest_step;
+  double rest_minBcl;
+  double rest_tolerance;
+  int rest_convergedBeats;
+  int rest_maxBeats;
+  int rest_stableBeats;
+  int rest_stepBeats;
+  double rest_previousAPD;
+  double rest_s1APD;
+  int rest_points;
+  // Latency and capacitance tests
+  RRC::LatencyProbe latency_probe;
+  double latency_amplitude;
+  bool latency_onFlag;
+  RRC::CapacitanceProbe cm_probe;
+  double cm_amplitude;
+  bool cm_onFlag;
+  // Dynamic clamp
+  dc_model_t dc_model;
+  double dc_conductance;
+  double dc_ek;
+  double dc_xr1;
+  double dc_xr2;
+  double dc_current;
+
+  RRC::APDDetector apd_detector;
+  RRC::Decimator analysis_decimator;
+  Analyzer beat_analyzer;
+  double beat_apd;
+  double output0;
+  bool success;
+  Cell cell;
+  long ticks;
+  Results &results;
+  std::vector<RRC::TraceSink *> traces; // Written every tick if not empty
+};
+
+// Runs the experiment of a scenario, returns beats paced. Ticks are written
+// to traces in traceDir unless it is empty
+int experiment(const Scenario &s, Results &results, long &ticks,
+               const std::string &traceDir) {
+  results.scenario = s.name;
+  Host m(s, results);
+  RRC::TraceWriter raw;
+  RRC::CompressedTraceWriter compressed;
+  if (!traceDir.empty()) {
+    std::string base = traceDir + "/" + s.name;
+    if (raw.open(base + ".rrct", s.period))
+      m.traces.push_back(&raw);
+    if (compressed.open(base + ".rrcz", s.period, 0.01, 1e-12))
+      m.traces.push_back(&compressed);
+    if (m.traces.size() != 2)
+      std::fprintf(stderr, "Unable to write traces %s\n", base.c_str());
+  }
+  m.idle(1000);
+
+  // Limits as set by steps of a sequence
+  m.stim_maxLevel = 10;
+  if (m.run("stim_threshold", Host::STIMTHRESHOLD, 60000))
+    results.add("stim_threshold", "amplitude", m.stim_amplitude);
+  m.idle(1000);
+
+  if (m.run("latency", Host::LATENCYTEST, 10000))
+    results.add("latency", "ticks", m.latency_probe.ticks());
+  m.idle(1000);
+
+  m.run("capacitance", Host::CAPACITANCE, 10000);
+  double cm, rm, tau;
+  bool fitted = m.cm_probe.fit(m.cm_amplitude, cm, rm, tau);
+  results.add("capacitance", "fitted", fitted);
+  if (fitted) {
+    results.add("capacitance", "cm", cm);
+    results.add("capacitance", "rm", rm);
+    results.add("capacitance", "tau", tau);
+  }
+  m.idle(1000);
+
+  int beats = 0;
+  m.pace_endBeat = 50;
+  m.run("pace", Host::PACE, 100 * s.bcl);
+  beats += m.beat_analyzer.beats;
+
+  m.thresh_maxAmplitude = 2;
+  if (m.run("rrc_threshold", Host::RRCTHRESHOLD, 1000 * s.bcl))
+    results.add("rrc_threshold", "amplitude", m.rrc_amplitude);
+  beats += m.beat_analyzer.beats;
+  m.idle(2000);
+
+  m.run("rrc_protocol", Host::RRCPROTOCOL, 200 * s.bcl);
+  beats += m.beat_analyzer.beats;
+  m.idle(2000);
+
+  m.run("dynamic_restitution", Host::DYNAMICRESTITUTION, 1000 * s.bcl);
+  beats += m.beat_analyzer.beats;
+  m.idle(2000);
+
+  m.run("s1s2_restitution", Host::S1S2RESTITUTION, 1000 * s.bcl);
+  beats += m.beat_analyzer.beats;
+
+  ticks = m.ticks;
+  return beats;
+}
+
+// Compares lines of a scenario with golden, returns lines that differ and
+// the first of them
+int compare(const std::vector<std::string> &lines,
+            const std::vector<std::string> &golden, const std::string &name,
+            std::string &first) {
+  std::vector<std::string> expected;
+  std::string prefix = name + ",";
+  for (size_t i = 0; i < golden.size(); i++)
+    if (golden[i].compare(0, prefix.size(), prefix) == 0)
+      expected.push_back(golden[i]);
+
+  int differ = 0;
+  size_t n = std::max(lines.size(), expected.size());
+  for (size_t i = 0; i < n; i++) {
+    const std::string &got = i < lines.size() ? lines[i] : "(none)";
+    const std::string &want = i < expected.size() ? expected[i] : "(none)";
+    if (got != want) {
+      if (differ++ == 0)
+        first = got + " expected " + want;
+    }
+  }
+  return differ;
+}
+}
+
+int main(int argc, char *argv[]) {
+  bool update = false;
+  int repeats = 3;
+  std::string traceDir;
+  std::string goldenFile = "rrc_scenarios.golden";
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "-u") == 0)
+      update = true;
+    else if (std::strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+      repeats = std::max(1, std::atoi(argv[++i]));
+    else if (std::strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+      traceDir = argv[++i];
+    else if (argv[i][0] == '-') {
+      std::fprintf(stderr,
+                   "Usage: %s [-u] [-r repeats] [-t dir] [golden file]\n",
+                   argv[0]);
+      return 2;
+    }
+    else
+      goldenFile = argv[i];
+  }
+
+  std::vector<std::string> golden;
+  if (!update) {
+    std::ifstream file(goldenFile.c_str());
+    if (!file.is_open()) {
+      std::fprintf(stderr, "Unable to read %s\n", goldenFile.c_str());
+      return 2;
+    }
+    std::string line;
+    while (std::getline(file, line))
+      if (!line.empty() && line[0] != '#')
+        golden.push_back(line);
+  }
+
+  std::printf("%-14s %7s %10s %10s %10s %8s\n", "scenario", "beats",
+              "sim s", "wall ms", "beats/s", "golden");
+  std::vector<std::string> all;
+  bool same = true;
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+    const Scenario &s = scenarios[i];
+    Results results;
+    int beats = 0;
+    long ticks = 0;
+    double best = HUGE_VAL;
+    for (int repeat = 0; repeat < repeats; repeat++) {
+      Results run;
+      std::chrono::steady_clock::time_point start =
+          std::chrono::steady_clock::now();
+      beats = experiment(s, run, ticks, repeat == 0 ? traceDir : "");
+      std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+      best = std::min(best, elapsed.count());
+      // Runs of a scenario must agree with each other as well
+      if (repeat == 0)
+        results = run;
+      else if (run.lines != results.lines)
+        same = false;
+    }
+
+    const char *status = "written";
+    std::string first;
+    if (!update) {
+      int differ = compare(results.lines, golden, s.name, first);
+      status = differ ? "DIFFER" : "same";
+      same = same && differ == 0;
+    }
+    std::printf("%-14s %7d %10.1f %10.1f %10.0f %8s\n", s.name, beats,
+                ticks * s.period / 1000, best, beats / best * 1000, status);
+    if (!first.empty())
+      std::printf("  first difference: %s\n", first.c_str());
+    all.insert(all.end(), results.lines.begin(), results.lines.end());
+  }
+
+  if (update) {
+    std::ofstream file(goldenFile.c_str());
+    file << "# Golden results of rrc_scenarios, scenario,protocol,item,value\n";
+    for (size_t i = 0; i < all.size(); i++)
+      file << all[i] << '\n';
+    if (!file) {
+      std::fprintf(stderr, "Unable to write %s\n", goldenFile.c_str());
+      return 2;
+    }
+  }
+  return same ? 0 : 1;
+}
@@ -0,0 +1,530 @@
+// Tuning of the APD detector settings against manually marked APDs
+//
+// Replays the marked beats of recorded sessions through RRC::APDDetector, the
+// same code calculateAPD() runs online, for every candidate setting and keeps
+// the one with the smallest mean absolute APD error. Candidates are evaluated
+// in parallel.
+//
+// Marks are a CSV file with the columns file,trial,beat,apd_ms, one line per
+// marked beat. An APD of 0 marks a beat that should not count as an AP. Each
+// marked beat is replayed together with the beat before it, so the detector
+// reaches the marked stimulus in the state it had online. A beat whose APD is
+// not found before the next stimulus counts as 0.
+//
+// Ranges are MIN:MAX:STEP or a single value. The minimum APD is only applied
+// to found APDs and does not change the replay, so it is always searched over
+// its whole range for each replayed candidate.
+//
+// Usage: rrc_tune [options] marks.csv
+//   -j N               Number of worker threads (default: number of cores)
+//   --repol RANGE      APD repolarization percentage (default: 90)
+//   --window RANGE     Stimulus window (ms) (default: 1:10:1)
+//   --hold RANGE       Time peak must hold (ms) (default: 1:10:1)
+//   --upstroke RANGE   Upstroke threshold (mV) (default: -60:-10:5)
+//   --min RANGE        Minimum APD (ms) (default: 0:100:10)
+//   --decimate N       Samples averaged per detector step, as set online
+//                      (default: 1)
+//   --random N         Evaluate N random candidates instead of the full grid
+//   --seed N           Seed of random candidates (default: 1)
+//   --settings FILE    Also write the best settings into a saved settings
+//                      file, in each <OBJECT> of the module. The file is left
+//                      unchanged if one of its parameters is missing
+//   --voltage NAME     Channel name suffix of membrane voltage
+//                      (default: "Voltage (mV)")
+//   --beat NAME        Channel name suffix of beat number
+//                      (default: "Beat Number")
+//   --time NAME        Channel name suffix of time (default: "Time (ms)")
+//
+// The best settings are written to standard output as the <PARAM> elements
+// of the module's saved settings, which doLoad() reads, and as a control
+// socket set command.
+
+#include "RRC_APD.h"
+#include "RRC_Decimator.h"
+#include "rrc_recording.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+// Values of one setting, MIN:MAX:STEP
+struct Range {
+  Range(double value) : min(value), max(value), step(1) {}
+
+  bool parse(const std::string &text) {
+    std::istringstream in(text);
+    char colon1 = ':', colon2 = ':';
+    if (!(in >> min))
+      return false;
+    max = min;
+    step = 1;
+    if (!in.eof() && !(in >> colon1 >> max >> colon2 >> step))
+      return false;
+    return in.eof() && colon1 == ':' && colon2 == ':' && step > 0 &&
+        max >= min;
+  }
+
+  std::vector<double> values() const {
+    std::vector<double> result;
+    // Half a step of slack so rounding does not drop the last value
+    for (int i = 0; min + i * step <= max + step / 2; i++)
+      result.push_back(min + i * step);
+    return result;
+  }
+
+  double min;
+  double max;
+  double step;
+};
+
+struct Options {
+  Options() : threads(0), decimation(1), random(0), seed(1),
+              repolPercent(90), stimWindow(1), peakHold(1),
+              upstrokeThreshold(-60), minApd(0) {
+    stimWindow.max = 10;
+    peakHold.max = 10;
+    upstrokeThreshold.max = -10;
+    upstrokeThreshold.step = 5;
+    minApd.max = 100;
+    minApd.step = 10;
+  }
+  unsigned threads;
+  int decimation;
+  unsigned random;
+  unsigned seed;
+  std::string settingsFile;
+  Range repolPercent;
+  Range stimWindow;
+  Range peakHold;
+  Range upstrokeThreshold;
+  Range minApd;
+  RRCTools::Channels channels;
+};
+
+struct Mark {
+  std::string file;
+  int trial;
+  int beat;
+  double apd;
+};
+
+// Samples of a marked beat and the beat before it
+struct Segment {
+  Segment() : period(0), trialStart(false), target(0), mark(0) {}
+  double period;
+  bool trialStart; // First sample is the first of its trial
+  int target; // Marked beat number
+  double mark; // Marked APD (ms)
+  std::vector<double> time;
+  std::vector<double> voltage;
+  std::vector<int> beat;
+};
+
+// Detector settings replayed, the minimum APD is applied afterwards
+struct Candidate {
+  int repolPercent;
+  int stimWindow;
+  double peakHold;
+  double upstrokeThreshold;
+  int decimation;
+};
+
+// Keeps the samples of the marked beats of one file
+class Collector {
+ public:
+  Collector(const std::vector<Mark> &marks, const std::string &file,
+            std::vector<Segment> &segments) :
+      trialNumber(0), period(0), first(false) {
+    for (size_t i = 0; i < marks.size(); i++) {
+      if (marks[i].file != file)
+        continue;
+      size_t index = segments.size();
+      segments.push_back(Segment());
+      segments.back().target = marks[i].beat;
+      segments.back().mark = marks[i].apd;
+      wanted[std::make_pair(marks[i].trial, marks[i].beat - 1)].
+          push_back(index);
+      wanted[std::make_pair(marks[i].trial, marks[i].beat)].push_back(index);
+    }
+    this->segments = &segments;
+  }
+
+  void trial(int trialNumber, double period) {
+    this->trialNumber = trialNumber;
+    this->period = period;
+    first = true;
+  }
+
+  void sample(double time, double voltage, double beat) {
+    std::map<std::pair<int, int>, std::vector<size_t> >::const_iterator it =
+        wanted.find(std::make_pair(trialNumber,
+                                   static_cast<int>(std::floor(beat + 0.5))));
+    if (it != wanted.end()) {
+      for (size_t i = 0; i < it->second.size(); i++) {
+        Segment &segment = (*segments)[it->second[i]];
+        if (segment.time.empty()) {
+          segment.period = period;
+          segment.trialStart = first;
+        }
+        segment.time.push_back(time);
+        segment.voltage.push_back(voltage);
+        segment.beat.push_back(it->first.second);
+      }
+    }
+    first = false;
+  }
+
+ private:
+  std::map<std::pair<int, int>, std::vector<size_t> > wanted;
+  std::vector<Segment> *segments;
+  int trialNumber;
+  double period;
+  bool first;
+};
+
+// Replays a segment in the same order as execute() and rrc_replay. Returns
+// the first APD found during the marked beat, -1 if none
+double replay(const Segment &segment, const Candidate &candidate) {
+  RRC::APDDetector detector;
+  detector.repolPercent = candidate.repolPercent;
+  detector.stimWindow = candidate.stimWindow;
+  detector.peakHold = candidate.peakHold;
+  detector.upstrokeThreshold = candidate.upstrokeThreshold;
+  RRC::Decimator decimator;
+  decimator.factor = candidate.decimation;
+
+  size_t n = segment.time.size();
+  for (size_t i = 0; i < n; i++) {
+    double time = segment.time[i];
+    double voltage = segment.voltage[i];
+    if (i == 0)
+      detector.start(segment.trialStart ? time - segment.period : time,
+                     voltage);
+    else if (segment.beat[i] != segment.beat[i - 1]) {
+      detector.beat(time, voltage);
+      decimator.reset();
+    }
+
+    if (decimator.push(time, voltage) &&
+        detector.step(decimator.time, decimator.voltage) &&
+        segment.beat[i] == segment.target)
+      return detector.apd;
+  }
+  return -1;
+}
+
+struct Result {
+  Result() : error(HUGE_VAL), candidate(0), minApd(0) {}
+
+  // Ties go to the earlier candidate, so results do not depend on threads
+  bool operator<(const Result &other) const {
+    if (error != other.error)
+      return error < other.error;
+    if (candidate != other.candidate)
+      return candidate < other.candidate;
+    return minApd < other.minApd;
+  }
+
+  double error; // Mean absolute APD error (ms)
+  size_t candidate;
+  double minApd;
+};
+
+// Best minimum APD for one replayed candidate
+Result evaluate(const std::vector<Segment> &segments,
+                const Candidate &candidate, size_t index,
+                const std::vector<double> &minApds) {
+  std::vector<double> apds(segments.size());
+  for (size_t i = 0; i < segments.size(); i++)
+    apds[i] = replay(segments[i], candidate);
+
+  Result best;
+  for (size_t m = 0; m < minApds.size(); m++) {
+    double sum = 0;
+    for (size_t i = 0; i < segments.size(); i++) {
+      double apd = apds[i] < minApds[m] ? 0 : apds[i]; // Also -1, not found
+      sum += std::fabs(apd - segments[i].mark);
+    }
+    Result result;
+    result.error = sum / segments.size();
+    result.candidate = index;
+    result.minApd = minApds[m];
+    if (result < best)
+      best = result;
+  }
+  return best;
+}
+
+bool readMarks(const std::string &fileName, std::vector<Mark> &marks) {
+  std::ifstream in(fileName.c_str());
+  if (!in.is_open()) {
+    RRCTools::logError(fileName, "unable to open file");
+    return false;
+  }
+
+  std::string line;
+  for (int lineNumber = 1; std::getline(in, line); lineNumber++) {
+    if (line.empty() || line[0] == '#' || line.compare(0, 5, "file,") == 0)
+      continue;
+    std::istringstream fields(line);
+    Mark mark;
+    std::string trial, beat, apd;
+    if (!std::getline(fields, mark.file, ',') ||
+        !std::getline(fields, trial, ',') ||
+        !std::getline(fields, beat, ',') || !std::getline(fields, apd)) {
+      std::ostringstream message;
+      message << "line " << lineNumber << ": expected file,trial,beat,apd_ms";
+      RRCTools::logError(fileName, message.str());
+      return false;
+    }
+    mark.trial = std::atoi(trial.c_str());
+    mark.beat = std::atoi(beat.c_str());
+    mark.apd = std::atof(apd.c_str());
+    marks.push_back(mark);
+  }
+  if (marks.empty()) {
+    RRCTools::logError(fileName, "no marked beats");
+    return false;
+  }
+  return true;
+}
+
+// Library of the module, named in the tag of its <OBJECT> elements
+const char *moduleLibrary = "repolarization_reserve_current";
+
+// Replaces the values of the <PARAM> elements in each <OBJECT> of the module
+// in a saved settings file. The new file is written next to it and renamed
+// over it, so it is left unchanged on failure. Returns false if the module
+// or one of its parameters is missing or the file could not be rewritten
+bool writeSettings(const std::string &fileName,
+                   const std::vector<std::pair<std::string, double> > &params) {
+  std::ifstream in(fileName.c_str());
+  if (!in.is_open()) {
+    RRCTools::logError(fileName, "unable to open file");
+    return false;
+  }
+  std::ostringstream contents;
+  contents << in.rdbuf();
+  in.close();
+
+  std::string text = contents.str();
+  int objects = 0;
+  for (size_t object = text.find("<OBJECT"); object != std::string::npos;
+       object = text.find("<OBJECT", object + 1)) {
+    size_t tagEnd = text.find('>', object);
+    if (tagEnd == std::string::npos ||
+        text.substr(object, tagEnd - object).find(moduleLibrary) ==
+            std::string::npos)
+      continue;
+    objects++;
+
+    for (size_t i = 0; i < params.size(); i++) {
+      std::string open = "<PARAM name=\"" + params[i].first + "\">";
+      size_t objectEnd = text.find("</OBJECT>", tagEnd);
+      size_t start = text.find(open, tagEnd);
+      size_t end = start == std::string::npos ?
+          std::string::npos : text.find("</PARAM>", start);
+      if (end == std::string::npos || end > objectEnd) {
+        RRCTools::logError(fileName, "no parameter " + params[i].first);
+        return false;
+      }
+      std::ostringstream value;
+      value << params[i].second;
+      start += open.size();
+      text.replace(start, end - start, value.str());
+    }
+  }
+  if (objects == 0) {
+    RRCTools::logError(fileName, "no settings of the module");
+    return false;
+  }
+
+  // New file keeps the permissions of the one it replaces
+  struct stat status;
+  std::string temporary = fileName + ".tmp";
+  std::ofstream out(temporary.c_str());
+  out << text;
+  out.close();
+  if (stat(fileName.c_str(), &status) == 0)
+    chmod(temporary.c_str(), status.st_mode & 07777);
+  if (!out || std::rename(temporary.c_str(), fileName.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    RRCTools::logError(fileName, "unable to write file");
+    return false;
+  }
+  return true;
+}
+
+void usage() {
+  std::cerr << "Usage: rrc_tune [-j threads] [--repol RANGE] "
+            << "[--window RANGE] [--hold RANGE] [--upstroke RANGE] "
+            << "[--min RANGE] [--decimate N] [--random N] [--seed N] "
+            << "[--settings FILE] "
+            << "[--voltage NAME] [--beat NAME] [--time NAME] marks.csv"
+            << std::endl;
+}
+}
+
+int main(int argc, char *argv[]) {
+  Options options;
+  std::string marksFile;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    bool ok = true;
+    if (arg == "-j" && hasValue)
+      options.threads = std::atoi(argv[++i]);
+    else if (arg == "--repol" && hasValue)
+      ok = options.repolPercent.parse(argv[++i]);
+    else if (arg == "--window" && hasValue)
+      ok = options.stimWindow.parse(argv[++i]);
+    else if (arg == "--hold" && hasValue)
+      ok = options.peakHold.parse(argv[++i]);
+    else if (arg == "--upstroke" && hasValue)
+      ok = options.upstrokeThreshold.parse(argv[++i]);
+    else if (arg == "--min" && hasValue)
+      ok = options.minApd.parse(argv[++i]);
+    else if (arg == "--decimate" && hasValue)
+      options.decimation = std::max(1, std::atoi(argv[++i]));
+    else if (arg == "--random" && hasValue)
+      options.random = std::atoi(argv[++i]);
+    else if (arg == "--seed" && hasValue)
+      options.seed = std::atoi(argv[++i]);
+    else if (arg == "--settings" && hasValue)
+      options.settingsFile = argv[++i];
+    else if (arg == "--voltage" && hasValue)
+      options.channels.voltage = argv[++i];
+    else if (arg == "--beat" && hasValue)
+      options.channels.beat = argv[++i];
+    else if (arg == "--time" && hasValue)
+      options.channels.time = argv[++i];
+    else if (!arg.empty() && arg[0] != '-' && marksFile.empty())
+      marksFile = arg;
+    else
+      ok = false;
+    if (!ok) {
+      usage();
+      return 1;
+    }
+  }
+  if (marksFile.empty()) {
+    usage();
+    return 1;
+  }
+
+  std::vector<Mark> marks;
+  if (!readMarks(marksFile, marks))
+    return 1;
+
+  // Only the marked beats are kept in memory
+  std::vector<std::string> files;
+  for (size_t i = 0; i < marks.size(); i++)
+    if (std::find(files.begin(), files.end(), marks[i].file) == files.end())
+      files.push_back(marks[i].file);
+  std::vector<Segment> segments;
+  for (size_t i = 0; i < files.size(); i++) {
+    Collector collector(marks, files[i], segments);
+    if (!RRCTools::readSession(files[i], options.channels, collector))
+      return 1;
+  }
+  for (size_t i = 0; i < segments.size(); i++)
+    if (segments[i].time.empty()) {
+      std::cerr << marksFile << ": marked beat " << segments[i].target
+                << " not found in recording" << std::endl;
+      return 1;
+    }
+
+  std::vector<double> repols = options.repolPercent.values();
+  std::vector<double> windows = options.stimWindow.values();
+  std::vector<double> holds = options.peakHold.values();
+  std::vector<double> upstrokes = options.upstrokeThreshold.values();
+  std::vector<Candidate> candidates;
+  if (options.random > 0) {
+    std::mt19937 generator(options.seed);
+    for (unsigned i = 0; i < options.random; i++) {
+      Candidate candidate;
+      candidate.repolPercent = repols[generator() % repols.size()];
+      candidate.stimWindow = windows[generator() % windows.size()];
+      candidate.peakHold = holds[generator() % holds.size()];
+      candidate.upstrokeThreshold = upstrokes[generator() % upstrokes.size()];
+      candidate.decimation = options.decimation;
+      candidates.push_back(candidate);
+    }
+  }
+  else {
+    for (size_t r = 0; r < repols.size(); r++)
+      for (size_t w = 0; w < windows.size(); w++)
+        for (size_t h = 0; h < holds.size(); h++)
+          for (size_t u = 0; u < upstrokes.size(); u++) {
+            Candidate candidate;
+            candidate.repolPercent = repols[r];
+            candidate.stimWindow = windows[w];
+            candidate.peakHold = holds[h];
+            candidate.upstrokeThreshold = upstrokes[u];
+            candidate.decimation = options.decimation;
+            candidates.push_back(candidate);
+          }
+  }
+
+  if (options.threads == 0)
+    options.threads = std::max(1u, std::thread::hardware_concurrency());
+  options.threads = std::min<unsigned>(options.threads, candidates.size());
+
+  // Each worker takes the next candidate and keeps its own best result
+  std::vector<double> minApds = options.minApd.values();
+  std::atomic<size_t> next(0);
+  std::vector<Result> best(options.threads);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < options.threads; t++)
+    workers.push_back(std::thread([&, t]() {
+      for (size_t i = next++; i < candidates.size(); i = next++) {
+        Result result = evaluate(segments, candidates[i], i, minApds);
+        if (result < best[t])
+          best[t] = result;
+      }
+    }));
+  for (size_t t = 0; t < workers.size(); t++)
+    workers[t].join();
+  Result result = *std::min_element(best.begin(), best.end());
+  const Candidate &candidate = candidates[result.candidate];
+
+  std::vector<std::pair<std::string, double> > params;
+  params.push_back(std::make_pair("apd_repolPercent",
+                                  candidate.repolPercent));
+  params.push_back(std::make_pair("apd_min", result.minApd));
+  params.push_back(std::make_pair("apd_stimWindow", candidate.stimWindow));
+  params.push_back(std::make_pair("apd_peakHold", candidate.peakHold));
+  params.push_back(std::make_pair("apd_upstrokeThreshold",
+                                  candidate.upstrokeThreshold));
+
+  std::cout << "<!-- Mean absolute APD error " << result.error << " ms over "
+            << segments.size() << " beats, " << candidates.size()
+            << " candidates -->\n";
+  for (size_t i = 0; i < params.size(); i++)
+    std::cout << "<PARAM name=\"" << params[i].first << "\">"
+              << params[i].second << "</PARAM>\n";
+  std::cout << "set";
+  for (size_t i = 0; i < params.size(); i++)
+    std::cout << ' ' << params[i].first << '=' << params[i].second;
+  std::cout << std::endl;
+
+  if (!options.settingsFile.empty() &&
+      !writeSettings(options.settingsFile, params))
+    return 1;
+  return 0;
+}